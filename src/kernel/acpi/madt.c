@@ -5,6 +5,7 @@
 #include "acpi.h"
 #include "hal/io_apic.h"
 #include "memory_management/physical_memory_manager.h"
+#include "memory_management/arena.h"
 #include "utils/printf.h"
 
 static Madt *MADT;
@@ -28,12 +29,6 @@ void ParseMadt()
 	MADT = (Madt*) FindTable("APIC");
 	int madt_len = MADT->header.length;
 
-	SMP_INFO.io_apics 		= 	AllocFirstFrame();
-	SMP_INFO.lapics 		= 	AllocFirstFrame();
-	SMP_INFO.isos 			= 	AllocFirstFrame();
-	SMP_INFO.nmi_sources 	=	AllocFirstFrame();
-	SMP_INFO.nmis			=	AllocFirstFrame();
-	
 	// MADT consists of:
 	// 	- SDT header (0x24 bytes);
 	// 	- 4-byte int giving physical addr of local APIC;
@@ -44,6 +39,29 @@ void ParseMadt()
 	// 		  determined by value in record header.
 	uint8_t *madt_record_base = ((uint8_t*) MADT + MADT_RECORDS_OFFSET);
 	uint8_t *record, record_type, record_len;
+
+	// Count records of each type first, so that each array can be sized
+	// exactly and carved from the boot arena.
+	size_t num_records[LOCAL_APIC_ADDRESS_OVERRIDE + 1] = { 0 };
+	for(int i = 0; (MADT_RECORDS_OFFSET + i) < madt_len; i += record_len) {
+		record_type = madt_record_base[i];
+		record_len 	= madt_record_base[i + 1];
+		if(record_type <= LOCAL_APIC_ADDRESS_OVERRIDE) {
+			++num_records[record_type];
+		}
+	}
+
+	SMP_INFO.io_apics 		= 	boot_alloc(num_records[IO_APIC] * 
+										   sizeof(IoApicRecord));
+	SMP_INFO.lapics 		= 	boot_alloc(num_records[PROCESSOR_LOCAL_APIC] *
+										   sizeof(ProcessorLocalApic));
+	SMP_INFO.isos 			= 	boot_alloc(num_records[INTERRUPT_SOURCE_OVERRIDE] *
+										   sizeof(IntSourceOverrideRecord));
+	SMP_INFO.nmi_sources 	=	boot_alloc(num_records[NON_MASKABLE_INTERRUPT_SOURCE] *
+										   sizeof(NmiSourceRecord));
+	SMP_INFO.nmis			=	boot_alloc(num_records[LOCAL_NON_MASKABLE_INTERRUPT] *
+										   sizeof(NmiRecord));
+
 	for(int i = 0; (MADT_RECORDS_OFFSET + i) < madt_len; i += record_len) {
 		record 		= (madt_record_base + i);
 		record_type = record[0];
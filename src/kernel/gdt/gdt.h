@@ -20,11 +20,17 @@
 #define PROT_M_SEG			0b11001111
 
 // Bytes 0-1 give ring, byte 2 is 0 for GDT, bytes 3-15 give
-// bytes 3-15 of segment offset from GDT in bytes.
+// bytes 3-15 of segment offset from GDT in bytes. sysret loads SS and CS from
+// the two descriptors after STAR's base, in that order, so user DS must come
+// just before user CS (see interrupts/syscall.h).
 #define KERN_CS_SEGSEL		0x28
 #define KERN_DS_SEGSEL		0x30
-#define USER_CS_SEGSEL		0x3B
-#define USER_DS_SEGSEL		0x43
+#define USER_DS_SEGSEL		0x3B
+#define USER_CS_SEGSEL		0x43
+// A user-readable data segment whose limit is the CPU's number, for the
+// vDSO's getcpu to read with lsl (see proc/vdso.h).
+#define CPU_NUMBER_SEGSEL	0x4B
+#define TSS_SEGSEL			0x50
 
 #include <stdint.h>
 #include <stddef.h>
@@ -95,7 +101,7 @@ typedef struct {
 
 
 typedef struct {
-	gdt_entry_t segments[9];
+	gdt_entry_t segments[10];
 	tss_entry_t tss;
 } __attribute__((packed)) gdt_t;
 
@@ -104,8 +110,12 @@ typedef struct {
 	uint64_t base;
 } __attribute__((packed)) gdt_descriptor_t;
 
+/**
+ * Build and load the calling CPU's GDT and TSS.
+ * @input stack Top of the stack to switch to on interrupts from user mode.
+ */
 void
-initialize_gdt();
+initialize_gdt(uint64_t stack);
 
 void init_tss(uint64_t stack);
 void load_tss(uint16_t tss_selector);
@@ -12,8 +12,8 @@ load_gdt:
     .flush:
         mov ax, 0x30
         mov ds, ax
-        mov fs, ax
-        mov gs, ax
+        ; FS and GS are left alone: in long mode their bases live in MSRs,
+        ; and loading a selector would zero the per-CPU GS base.
         mov ss, ax
         mov es, ax
         ret
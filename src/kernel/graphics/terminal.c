@@ -1,4 +1,5 @@
 #include "terminal.h"
+#include "memory_management/kheap.h"
 #include <stdbool.h>
 
 static Terminal main_term;
@@ -114,6 +115,12 @@ void RenderBorders(Terminal *term)
 
 void HandleKeyStroke(KeyInfo *key_info)
 {
+	// F12 is a debug key which dumps the heap profile.
+	if(key_info->scancode == F12_PRESSED) {
+		heap_print_profile();
+		return;
+	}
+
 	char c[2];
 	c[0] = CharFromScancode(key_info);
 	c[1] = 0;
@@ -0,0 +1,176 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RFLAGS_TF			(1 << 8)
+#define RFLAGS_IF			(1 << 9)
+#define RFLAGS_DF			(1 << 10)
+#define RFLAGS_NT			(1 << 14)
+#define RFLAGS_AC			(1 << 18)
+
+// Control register bits.
+#define CR0_MP				(1 << 1)
+#define CR0_EM				(1 << 2)
+#define CR0_TS				(1 << 3)
+#define CR0_NE				(1 << 5)
+#define CR4_OSFXSR			(1 << 9)
+#define CR4_OSXMMEXCPT		(1 << 10)
+#define CR4_OSXSAVE			(1 << 18)
+
+// Model-specific registers.
+#define MSR_TSC_DEADLINE	0x6E0
+#define MSR_EFER			0xC0000080
+#define MSR_STAR			0xC0000081
+#define MSR_LSTAR			0xC0000082
+#define MSR_SFMASK			0xC0000084
+#define MSR_FS_BASE			0xC0000100
+#define MSR_GS_BASE			0xC0000101
+#define MSR_KERNEL_GS_BASE	0xC0000102
+
+// EFER bits.
+#define EFER_SCE			(1 << 0)
+
+/** Thin wrappers around single x86-64 instructions. **/
+
+// Spin-wait hint. Lets a hyperthread sibling use the core, and avoids the
+// memory-order mis-speculation penalty when the awaited store arrives.
+static inline void
+cpu_relax()
+{
+	__asm__ volatile("pause" ::: "memory");
+}
+
+static inline uint64_t
+read_rflags()
+{
+	uint64_t rflags;
+	__asm__ volatile("pushfq\n\tpop %0" : "=r"(rflags) :: "memory");
+	return rflags;
+}
+
+// Disable interrupts, returning the previous RFLAGS for irq_restore.
+static inline uint64_t
+irq_save()
+{
+	uint64_t rflags = read_rflags();
+	__asm__ volatile("cli" ::: "memory");
+	return rflags;
+}
+
+// Re-enable interrupts only if they were enabled when irq_save was called.
+static inline void
+irq_restore(uint64_t rflags)
+{
+	if(rflags & RFLAGS_IF) {
+		__asm__ volatile("sti" ::: "memory");
+	}
+}
+
+// Enable interrupts and halt until one arrives. sti takes effect only after
+// the next instruction, so an interrupt cannot slip in between the two.
+static inline void
+safe_halt()
+{
+	__asm__ volatile("sti\n\thlt" ::: "memory");
+}
+
+// Arm address monitoring of the cache line holding addr, for mwait.
+static inline void
+monitor(const volatile void *addr)
+{
+	__asm__ volatile("monitor" :: "a"(addr), "c"(0), "d"(0) : "memory");
+}
+
+// Wait for a store to the monitored line or another break event.
+// @input hint The target C-state, in mwait's EAX format.
+// @input ext Extensions, in mwait's ECX format.
+static inline void
+mwait(uint32_t hint, uint32_t ext)
+{
+	__asm__ volatile("mwait" :: "a"(hint), "c"(ext) : "memory");
+}
+
+static inline bool
+irqs_enabled()
+{
+	return read_rflags() & RFLAGS_IF;
+}
+
+static inline void
+cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx,
+	  uint32_t *ecx, uint32_t *edx)
+{
+	__asm__ volatile("cpuid"
+		:	"=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+		:	"a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t
+read_cr0()
+{
+	uint64_t cr0;
+	__asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+	return cr0;
+}
+
+static inline void
+write_cr0(uint64_t cr0)
+{
+	__asm__ volatile("mov %0, %%cr0" :: "r"(cr0) : "memory");
+}
+
+static inline uint64_t
+read_cr4()
+{
+	uint64_t cr4;
+	__asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+	return cr4;
+}
+
+static inline void
+write_cr4(uint64_t cr4)
+{
+	__asm__ volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+static inline uint64_t
+read_cr3()
+{
+	uint64_t cr3;
+	__asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+	return cr3;
+}
+
+static inline void
+write_cr3(uint64_t cr3)
+{
+	__asm__ volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+}
+
+static inline uint64_t
+rdtsc()
+{
+	uint32_t low, high;
+	__asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t) high << 32) | low;
+}
+
+static inline uint64_t
+rdmsr(uint32_t msr)
+{
+	uint32_t low, high;
+	__asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+	return ((uint64_t) high << 32) | low;
+}
+
+static inline void
+wrmsr(uint32_t msr, uint64_t val)
+{
+	__asm__ volatile("wrmsr" 
+		:: "c"(msr), "a"((uint32_t) val), "d"((uint32_t) (val >> 32))
+		: "memory");
+}
+
+#endif
@@ -1,11 +1,18 @@
 #include "hal/cpu_init.h"
 #include "hal/lapic.h"
+#include "hal/percpu.h"
+#include "hal/fpu.h"
 #include "proc/sched.h"
 #include "utils/printf.h"
 #include "memory_management/physical_memory_manager.h"
+#include "memory_management/virtual_memory_manager.h"
 #include "gdt/gdt.h"
+#include "interrupts/syscall.h"
+#include "proc/vdso.h"
 
 static uint8_t bsp_lapic_id;
+// Number of APs which have finished ap_entry.
+static uint32_t APS_ONLINE;
 
 void startup_aps(struct stivale2_struct_tag_smp *cpu_info)
 {
@@ -13,29 +20,60 @@ void startup_aps(struct stivale2_struct_tag_smp *cpu_info)
 	lapic_timer_init(0xFF);
 
 	bsp_lapic_id = cpu_info->bsp_lapic_id;
+	// Only MAX_CPUS CPUs, the BSP included, get a per-CPU area; leave the rest
+	// parked in the bootloader.
+	uint32_t aps = 0;
 	for(int i = 0; i < cpu_info->cpu_count; ++i) {
-		if(cpu_info->smp_info[i].lapic_id != cpu_info->bsp_lapic_id) {
-			cpu_info->smp_info[i].target_stack = (uint64_t) AllocFirstFrame();
-			cpu_info->smp_info[i].goto_address = ((uint64_t) &ap_entry);
+		if(cpu_info->smp_info[i].lapic_id == cpu_info->bsp_lapic_id) {
+			continue;
 		}
+		if(aps == MAX_CPUS - 1) {
+			PrintK("Skipping CPU with LAPIC ID %d: at most %d CPUs are supported.\n",
+				   (uint64_t) cpu_info->smp_info[i].lapic_id, (uint64_t) MAX_CPUS);
+			continue;
+		}
+		++aps;
+		// Stacks grow down, so point at the top of the frame; this is also
+		// the AP's TSS.RSP0. The AP goes on to run its idle task on this
+		// stack, including while a process pagemap is loaded, so use the
+		// higher-half mapping which those pagemaps share.
+		cpu_info->smp_info[i].target_stack = 
+			(uint64_t) AllocFirstFrame() + 0x1000 + KERNEL_DATA;
+		cpu_info->smp_info[i].goto_address = ((uint64_t) &ap_entry);
+	}
+
+	// APs calibrate their timers against the PIT, whose IRQ is serviced here,
+	// so wait for them before the caller masks it.
+	while(__atomic_load_n(&APS_ONLINE, __ATOMIC_ACQUIRE) < aps) {
+		__asm__ volatile("pause");
 	}
 }
 
-void ap_entry()
+void ap_entry(struct stivale2_smp_info *smp_info)
 {
+	// Everything below, PrintK's lock included, may touch per-CPU data.
+	// startup_aps starts no more CPUs than there are areas, so running out
+	// leaves this CPU nothing safe to do but stop.
+	if(!percpu_init(smp_info->lapic_id)) {
+		for(;;) {
+			__asm__ volatile("cli; hlt");
+		}
+	}
+	LoadKernelPageTable();
+	fpu_init();
+
 	PrintK("Enabling LAPIC.\n");
 	enable_lapic();
-	
-	uint64_t rbp;
-	asm volatile(
-			"mov %%rbp, %0"
-		:	"=r"(rbp)
-	::);
-
-	//init_tss(rbp);
-	//load_tss(0x48);
+	initialize_gdt(smp_info->target_stack);
+	syscall_init();
+	vdso_cpu_init();
 	lapic_timer_init(0xFF);
+	local_init_scheduler();
 	PrintK("Processor online.\n");
+	__atomic_fetch_add(&APS_ONLINE, 1, __ATOMIC_RELEASE);
+
+	// This is now the idle task.
+	sched_idle();
 }
 
 uint8_t get_bsp_lapic_id()
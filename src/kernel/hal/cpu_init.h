@@ -4,7 +4,7 @@
 #include "stivale2.h"
 
 void startup_aps(struct stivale2_struct_tag_smp *smp_info);
-void ap_entry();
+void ap_entry(struct stivale2_smp_info *smp_info);
 uint8_t get_bsp_lapic_id();
 
 #endif
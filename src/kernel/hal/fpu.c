@@ -0,0 +1,182 @@
+#include "hal/fpu.h"
+#include "hal/cpu.h"
+#include "hal/percpu.h"
+#include "proc/sched.h"
+#include "memory_management/physical_memory_manager.h"
+#include "memory_management/virtual_memory_manager.h"
+#include "utils/printf.h"
+#include "utils/string.h"
+
+// CPUID.1:ECX feature bits.
+#define CPUID_1_ECX_XSAVE		(1 << 26)
+#define CPUID_1_ECX_AVX			(1 << 28)
+// CPUID.(0xD,1):EAX feature bits.
+#define CPUID_D_1_EAX_XSAVEOPT	(1 << 0)
+
+// XCR0 state components.
+#define XCR0_X87				(1 << 0)
+#define XCR0_SSE				(1 << 1)
+#define XCR0_AVX				(1 << 2)
+
+// Offsets into the legacy region of an FXSAVE/XSAVE area.
+#define FXSAVE_FCW_OFFSET		0
+#define FXSAVE_MXCSR_OFFSET		24
+#define DEFAULT_FCW				0x037F
+#define DEFAULT_MXCSR			0x1F80
+
+typedef enum {
+	FPU_FXSAVE,
+	FPU_XSAVE,
+	FPU_XSAVEOPT
+} fpu_save_mode_t;
+
+// Set up by the BSP; APs are assumed to support the same features.
+static fpu_save_mode_t FPU_SAVE_MODE;
+static uint64_t XCR0;
+
+static inline void
+xsetbv(uint32_t reg, uint64_t val)
+{
+	__asm__ volatile("xsetbv"
+		:: "c"(reg), "a"((uint32_t) val), "d"((uint32_t) (val >> 32)));
+}
+
+static inline void
+clts()
+{
+	__asm__ volatile("clts" ::: "memory");
+}
+
+static inline void
+stts()
+{
+	write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void
+fpu_save(void *area)
+{
+	switch(FPU_SAVE_MODE) {
+	case FPU_XSAVEOPT:
+		__asm__ volatile("xsaveopt64 (%0)"
+			:: "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+		break;
+	case FPU_XSAVE:
+		__asm__ volatile("xsave64 (%0)"
+			:: "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+		break;
+	case FPU_FXSAVE:
+		__asm__ volatile("fxsave64 (%0)" :: "r"(area) : "memory");
+		break;
+	}
+}
+
+static inline void
+fpu_restore(void *area)
+{
+	if(FPU_SAVE_MODE == FPU_FXSAVE) {
+		__asm__ volatile("fxrstor64 (%0)" :: "r"(area) : "memory");
+	} else {
+		__asm__ volatile("xrstor64 (%0)"
+			:: "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+	}
+}
+
+/**
+ * Give a task a save area holding the initial state. With XSAVE, the zeroed
+ * header marks every component as in its initial configuration; only the
+ * control words, which are loaded regardless, need setting.
+ */
+static bool
+fpu_alloc_state(pcb_t *pcb)
+{
+	// A frame satisfies XSAVE's 64-byte alignment, and is large enough for
+	// x87, SSE and AVX state.
+	void *frame = AllocFirstFrame();
+	if(!frame) {
+		return false;
+	}
+
+	uint8_t *area = (uint8_t*) frame + KERNEL_DATA;
+	*(uint16_t*) (area + FXSAVE_FCW_OFFSET)		= DEFAULT_FCW;
+	*(uint32_t*) (area + FXSAVE_MXCSR_OFFSET)	= DEFAULT_MXCSR;
+	pcb->fpu_state = area;
+	return true;
+}
+
+void
+fpu_init()
+{
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+
+	// Native x87 error reporting, no emulation, and trap on first use.
+	write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+
+	uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+	if(!(ecx & CPUID_1_ECX_XSAVE)) {
+		write_cr4(cr4);
+		FPU_SAVE_MODE = FPU_FXSAVE;
+		return;
+	}
+
+	write_cr4(cr4 | CR4_OSXSAVE);
+	if(cpu_index() == 0) {
+		XCR0 = XCR0_X87 | XCR0_SSE | ((ecx & CPUID_1_ECX_AVX) ? XCR0_AVX : 0);
+		cpuid(0xD, 1, &eax, &ebx, &ecx, &edx);
+		FPU_SAVE_MODE = (eax & CPUID_D_1_EAX_XSAVEOPT) ? FPU_XSAVEOPT : FPU_XSAVE;
+	}
+	xsetbv(0, XCR0);
+}
+
+void
+fpu_switch(pcb_t *prev, pcb_t *next)
+{
+	percpu_t *cpu = this_cpu();
+
+	// TS is clear only if prev's state was loaded during its slice.
+	if(!(read_cr0() & CR0_TS) && prev->fpu_state) {
+		fpu_save(prev->fpu_state);
+	}
+
+	// If nothing has been loaded over next's state since it last ran here,
+	// let it use the registers as they are.
+	if(cpu->fpu_owner == next && next->fpu_cpu == cpu->cpu_index) {
+		clts();
+	} else {
+		stts();
+	}
+}
+
+void
+fpu_release(pcb_t *pcb)
+{
+	for(uint32_t i = 0; i < num_cpus(); ++i) {
+		pcb_t *expected = pcb;
+		__atomic_compare_exchange_n(&percpu_of(i)->fpu_owner, &expected, NULL,
+									false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+
+	if(pcb->fpu_state) {
+		FreeFrame((uint8_t*) pcb->fpu_state - KERNEL_DATA);
+		pcb->fpu_state = NULL;
+	}
+}
+
+void
+fpu_trap_handler()
+{
+	clts();
+
+	pcb_t *task = current_task();
+	if(!task->fpu_state && !fpu_alloc_state(task)) {
+		PrintK("Out of memory for FPU state of thread %d.\n", (uint64_t) task->tid);
+		exit_current_task();
+	}
+
+	// The previous owner, if any, was saved when it was switched out.
+	fpu_restore(task->fpu_state);
+	percpu_t *cpu = this_cpu();
+	cpu->fpu_owner	= task;
+	task->fpu_cpu	= cpu->cpu_index;
+}
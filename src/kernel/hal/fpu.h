@@ -0,0 +1,46 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdbool.h>
+#include "proc/proc.h"
+
+/** Lazy x87/SSE/AVX state switching.
+ * The kernel is built without SSE, so only user tasks touch the extended
+ * register state. A switch leaves CR0.TS set unless the next task's state is
+ * still in this CPU's registers; the first FPU/SSE instruction the task then
+ * executes raises #NM, whose handler loads its state. Tasks which never touch
+ * these registers are never saved or restored.
+ *
+ * State is saved with XSAVEOPT where available (which skips components
+ * unmodified since the last XRSTOR), then XSAVE, then FXSAVE.
+**/
+
+/**
+ * Enable the FPU and SSE (and XSAVE, if present) on the calling CPU, with
+ * CR0.TS set.
+ */
+void
+fpu_init();
+
+/**
+ * Save prev's extended state if it used it during its slice, and arm the #NM
+ * trap for next unless its state is still live on this CPU. Called on every
+ * context switch, with interrupts disabled.
+ */
+void
+fpu_switch(pcb_t *prev, pcb_t *next);
+
+/**
+ * Forget a task's extended state, so that no CPU mistakes another task for it
+ * later. Called once the task is dead.
+ */
+void
+fpu_release(pcb_t *pcb);
+
+/**
+ * #NM (device not available) handler.
+ */
+void
+fpu_trap_handler();
+
+#endif
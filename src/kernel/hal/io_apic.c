@@ -2,9 +2,22 @@
 #include "lapic.h"
 #include "utils/printf.h"
 #include "cpu_init.h"
+#include "utils/rw_lock.h"
+#include "utils/seq_lock.h"
+#include "utils/spin_lock.h"
 
+// IOAPICS is filled once while parsing the MADT and then only looked up, so
+// it sits behind a reader-writer lock. Entries are never removed, so pointers
+// into it remain valid after the read lock is dropped.
 static ioapic_t IOAPICS[MAX_IOAPICS];
+static rw_lock_t IOAPICS_LOCK;
+// Lookups of VECTOR_ATTRS copy out a few fields, so a seqlock lets them run
+// without writing to the lock.
 static int_attr_t VECTOR_ATTRS[256];
+static seq_lock_t VECTOR_ATTRS_LOCK;
+// IOREGSEL/IOWIN form a single index/data pair shared by all CPUs, so each
+// register access must be done as a unit.
+static spin_lock_t IOAPIC_REG_LOCK;
 
 static uint32_t
 ioapic_read(ioapic_t *ioapic, uint8_t offset);
@@ -46,7 +59,9 @@ register_ioapic(IoApicRecord ioapic_record)
 								IOAPIC_MAX_RED_SHIFT) + 1;
 	ioapic.has_eoi			=  (ioapic_ver_reg & (IOAPIC_VERSION_MASK)) >= 0x20;	
 
+	write_lock(&IOAPICS_LOCK);
 	IOAPICS[ioapic.apic_id] = ioapic;
+	write_unlock(&IOAPICS_LOCK);
 	initialize_ioapic_ints(&ioapic);
 }
 
@@ -121,7 +136,12 @@ vector_from_gsi(uint32_t gsi)
 bool
 int_attrs_from_vector(uint8_t vector, ioredtbl_t *entry_to_fill)
 {
-	uint32_t gsi		=	VECTOR_ATTRS[vector].gsi;
+	uint32_t gsi, seq;
+	do {
+		seq				=	read_seqbegin(&VECTOR_ATTRS_LOCK);
+		gsi				=	VECTOR_ATTRS[vector].gsi;
+	} while(read_seqretry(&VECTOR_ATTRS_LOCK, seq));
+
 	ioapic_t *ioapic 	= 	ioapic_from_gsi(gsi);
 	if(!ioapic || !entry_to_fill)
 		return false;
@@ -159,7 +179,10 @@ ioapic_set_gsi_vector(uint32_t gsi, uint8_t vector)
 	if(current_entry.vector != vector) {
 		current_entry.vector = vector;
 		ioapic_write_entry(ioapic, gsi, current_entry);
+
+		uint64_t rflags = write_seqlock(&VECTOR_ATTRS_LOCK);
 		VECTOR_ATTRS[vector].gsi = gsi;
+		write_sequnlock(&VECTOR_ATTRS_LOCK, rflags);
 	}
 
 	return true;
@@ -232,15 +255,20 @@ ioapic_reroute_gsi(uint32_t gsi, uint8_t lapic_id)
 static uint32_t
 ioapic_read(ioapic_t *ioapic, uint8_t offset)
 {
+	uint64_t rflags = spin_lock_irqsave(&IOAPIC_REG_LOCK);
 	*(ioapic->ioregsel) = offset;
-	return *(ioapic->iowin);
+	uint32_t val = *(ioapic->iowin);
+	spin_unlock_irqrestore(&IOAPIC_REG_LOCK, rflags);
+	return val;
 }
 
 static void
 ioapic_write(ioapic_t *ioapic, uint8_t offset, uint32_t val)
 {
+	uint64_t rflags = spin_lock_irqsave(&IOAPIC_REG_LOCK);
 	*(ioapic->ioregsel) = offset;
 	*(ioapic->iowin) = val;
+	spin_unlock_irqrestore(&IOAPIC_REG_LOCK, rflags);
 }
 
 static void
@@ -283,17 +311,22 @@ get_trigger_mode(uint16_t flags)
 ioapic_t*
 ioapic_from_gsi(uint32_t gsi)
 {
+	ioapic_t *ioapic = NULL;
+	read_lock(&IOAPICS_LOCK);
 	for(int i = 0; i < MAX_IOAPICS; ++i) {
 		if(! IOAPICS[i].present)
 			continue;
 
 		uint32_t min_gsi = IOAPICS[i].min_gsi,
 				 max_gsi = IOAPICS[i].min_gsi + IOAPICS[i].num_pins - 1;
-		if(gsi >= min_gsi && gsi <= max_gsi)
-			return &IOAPICS[i];
+		if(gsi >= min_gsi && gsi <= max_gsi) {
+			ioapic = &IOAPICS[i];
+			break;
+		}
 	}
+	read_unlock(&IOAPICS_LOCK);
 
-	return NULL;
+	return ioapic;
 }
 
 void
@@ -360,10 +393,12 @@ initialize_ioapic_ints(ioapic_t *ioapic)
 		}
 		
 		entry.destination_mode					=	IOAPIC_PHYSICAL;
+		uint64_t rflags = write_seqlock(&VECTOR_ATTRS_LOCK);
 		VECTOR_ATTRS[entry.vector].attrs 		= 	entry;
 		VECTOR_ATTRS[entry.vector].gsi 			= 	gsi;
 		VECTOR_ATTRS[entry.vector].irq 			= 	entry.vector - 0x20;
 		VECTOR_ATTRS[entry.vector].ioapic_ind 	= 	ioapic->apic_id;
+		write_sequnlock(&VECTOR_ATTRS_LOCK, rflags);
 
 		entry.destination	=	get_bsp_lapic_id();
 		ioapic_write_entry(ioapic, gsi, entry);
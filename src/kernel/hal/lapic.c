@@ -2,12 +2,13 @@
 #include "hal/pit.h"
 #include "acpi/madt.h"
 #include "utils/printf.h"
+#include "hal/percpu.h"
+#include "hal/cpu.h"
+#include "memory_management/virtual_memory_manager.h"
 #include "utils/spin_lock.h"
 
 // Base address of LAPIC MMIO patch.
 static uintptr_t LAPIC_BASE;
-// Entry n stores the frequency in HZ of the timer of theLAPIC with ID n.
-static uint16_t LAPIC_TIMER_HZs[256];
 
 void
 lapic_write(lapic_reg_t lapic_reg, uint32_t val)
@@ -27,7 +28,9 @@ enable_lapic()
 	// Sth to note is that this uses the hardcoded LAPIC MMIO mapping.
 	// A more generic implementation would accomodate remappings.
 	smp_info_t smp_info = get_smp_info();
-	LAPIC_BASE = smp_info.lapic_addr;
+	// Use the higher-half mapping, which process pagemaps share, so that the
+	// LAPIC stays reachable (e.g. for EOIs) while a process is running.
+	LAPIC_BASE = smp_info.lapic_addr + KERNEL_DATA;
 	
 	// No NMIs.
 	NmiRecord *nmi;
@@ -49,7 +52,7 @@ void
 disable_lapic()
 {
 	smp_info_t smp_info = get_smp_info();
-	LAPIC_BASE = smp_info.lapic_addr;
+	LAPIC_BASE = smp_info.lapic_addr + KERNEL_DATA;
 
 	uint32_t current_val = lapic_read(LAPIC_SPURIOUS_INT_REG);
 	uint32_t enabled = current_val | (0 << 8);
@@ -150,7 +153,7 @@ lapic_timer_init(uint8_t vector)
 	lapic_write(LAPIC_DIVIDE_CONFIG_REG, 0b010);
 	lapic_write(LAPIC_INIT_COUNT_REG, 0xFFFFFFFF);
 	
-	wait(&PIT_COUNT_LOCK);
+	spin_lock(&PIT_COUNT_LOCK);
 
 	PIT_COUNT					=	0;
 	register_pit_handler(&pit_increment);
@@ -159,6 +162,7 @@ lapic_timer_init(uint8_t vector)
 	// passed, so let's get the PIT and LAPIC current counts at (roughly)
 	// the same time.
 	uint32_t init_lapic_count	=	lapic_read(LAPIC_CURRENT_COUNT_REG);
+	uint64_t init_tsc			=	rdtsc();
 	uint32_t pit_rate_hz 		=	1000;
 	uint32_t total_pit_tics		=	100;
 
@@ -171,14 +175,44 @@ lapic_timer_init(uint8_t vector)
 	while(PIT_COUNT < total_pit_tics);
 
 	uint32_t final_lapic_count	=	lapic_read(LAPIC_CURRENT_COUNT_REG);
+	uint64_t final_tsc			=	rdtsc();
 	uint32_t total_lapic_tics	=	(init_lapic_count - final_lapic_count) * 8;
 
-	release(&PIT_COUNT_LOCK);
+	spin_unlock(&PIT_COUNT_LOCK);
 	
-	uint8_t lapic_id			=	get_lapic_id();
-	LAPIC_TIMER_HZs[lapic_id] 	=	(total_lapic_tics / total_pit_tics) * pit_rate_hz;
+	uint32_t timer_hz			=	(total_lapic_tics / total_pit_tics) * pit_rate_hz;
+	percpu_write(lapic_timer_hz, timer_hz);
+	// The TSC is measured over the same interval, for the timer core.
+	percpu_write(tsc_hz, (final_tsc - init_tsc) / total_pit_tics * pit_rate_hz);
 	PrintK("LAPIC timer for LAPIC #%d has frequency of %d hz.\n",
-			lapic_id, LAPIC_TIMER_HZs[lapic_id]);
+			(uint64_t) percpu_read(lapic_id), (uint64_t) timer_hz);
+}
+
+void
+lapic_timer_set_mode(uint8_t vector, timer_mode_t mode)
+{
+	lvt_entry_t timer_entry;
+	timer_entry.dword			=	lapic_read(LAPIC_TIMER_REG);
+	timer_entry.vector			=	vector;
+	timer_entry.delivery_mode	=	LVT_FIXED;
+	timer_entry.mask			=	0;
+	timer_entry.timer_mode		=	mode;
+
+	// Disarm first, so that switching modes doesn't fire a stale count.
+	lapic_write(LAPIC_INIT_COUNT_REG, 0);
+	// Same divider as during calibration: the count drops once every 8
+	// ticks of the frequency measured by lapic_timer_init.
+	lapic_write(LAPIC_DIVIDE_CONFIG_REG, 0b010);
+	lapic_write(LAPIC_TIMER_REG, timer_entry.dword);
+	// Order the LVT write before any later IA32_TSC_DEADLINE write, which is
+	// not serializing.
+	__asm__ volatile("mfence" ::: "memory");
+}
+
+uint32_t
+lapic_timer_hz()
+{
+	return percpu_read(lapic_timer_hz);
 }
 
 //void
@@ -131,4 +131,21 @@ send_ipi(ipi_t *ipi);
 void
 lapic_timer_init(uint8_t vector);
 
+/**
+ * Unmask this CPU's LAPIC timer in the given mode, disarmed. Arm it by writing
+ * LAPIC_INIT_COUNT_REG (one-shot/periodic) or IA32_TSC_DEADLINE.
+ * @input vector The vector of the timer interrupt.
+ * @input mode ONE_SHOT, PERIODIC or TSC_DEADLINE.
+ */
+void
+lapic_timer_set_mode(uint8_t vector, timer_mode_t mode);
+
+/**
+ * @output The frequency in HZ of this CPU's LAPIC timer, as measured by
+ * 		   lapic_timer_init, or 0 if it has not been calibrated. Other CPUs'
+ * 		   frequencies are in their percpu_t.
+ */
+uint32_t
+lapic_timer_hz();
+
 #endif
@@ -0,0 +1,60 @@
+#include "hal/percpu.h"
+#include "hal/cpu.h"
+
+_Static_assert(MAX_CPUS <= sizeof(cpu_mask_t) * 8,
+			   "cpu_mask_t cannot hold MAX_CPUS");
+_Static_assert(offsetof(percpu_t, self) == PERCPU_SELF,
+			   "PERCPU_SELF does not match percpu_t");
+_Static_assert(offsetof(percpu_t, kernel_stack) == PERCPU_KERNEL_STACK,
+			   "PERCPU_KERNEL_STACK does not match percpu_t");
+_Static_assert(offsetof(percpu_t, user_stack) == PERCPU_USER_STACK,
+			   "PERCPU_USER_STACK does not match percpu_t");
+
+static percpu_t PERCPU[MAX_CPUS];
+static uint32_t NUM_CPUS;
+// Maps LAPIC IDs to per-CPU areas, for the few places (e.g. IPIs) where a
+// CPU is known only by its LAPIC ID.
+static percpu_t *PERCPU_BY_LAPIC_ID[256];
+
+percpu_t*
+percpu_init(uint8_t lapic_id)
+{
+	// Claim an index only while one is left, so that num_cpus() never exceeds
+	// MAX_CPUS.
+	uint32_t index = __atomic_load_n(&NUM_CPUS, __ATOMIC_RELAXED);
+	do {
+		if(index >= MAX_CPUS) {
+			return NULL;
+		}
+	} while(!__atomic_compare_exchange_n(&NUM_CPUS, &index, index + 1, false,
+										 __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	percpu_t *cpu = &PERCPU[index];
+
+	cpu->self		= cpu;
+	cpu->cpu_index	= index;
+	cpu->lapic_id	= lapic_id;
+	__atomic_store_n(&PERCPU_BY_LAPIC_ID[lapic_id], cpu, __ATOMIC_RELEASE);
+
+	wrmsr(MSR_GS_BASE, (uint64_t) cpu);
+	// Swapped in by swapgs when returning to user mode.
+	wrmsr(MSR_KERNEL_GS_BASE, 0);
+	return cpu;
+}
+
+percpu_t*
+percpu_of(uint32_t cpu_index)
+{
+	return &PERCPU[cpu_index];
+}
+
+percpu_t*
+percpu_from_lapic_id(uint8_t lapic_id)
+{
+	return __atomic_load_n(&PERCPU_BY_LAPIC_ID[lapic_id], __ATOMIC_ACQUIRE);
+}
+
+uint32_t
+num_cpus()
+{
+	return __atomic_load_n(&NUM_CPUS, __ATOMIC_RELAXED);
+}
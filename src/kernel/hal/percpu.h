@@ -0,0 +1,149 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "gdt/gdt.h"
+#include "hal/timer.h"
+#include "hal/topology.h"
+#include "proc/sched.h"
+#include "proc/workqueue.h"
+#include "proc/preempt.h"
+
+#define MAX_CPUS			64
+#define CACHE_LINE_SIZE		64
+
+// Offsets of the fields which assembly stubs reach through GS.
+#define PERCPU_SELF			0x00
+#define PERCPU_KERNEL_STACK	0x08
+#define PERCPU_USER_STACK	0x10
+
+/** Per-CPU data area.
+ * While in the kernel, GS base points at the running CPU's percpu_t, so any
+ * field is one gs-relative load away. On entry from and exit to user mode the
+ * GS base is exchanged with KERNEL_GS_BASE by swapgs, which keeps the user's
+ * GS base (0 for now) in the MSR while the kernel runs.
+ *
+ * Each area is cache-line aligned, and fields written by other CPUs should be
+ * grouped on their own line, so CPUs don't falsely share each other's data.
+**/
+typedef struct percpu {
+	// Must be first: this_cpu() loads gs:0.
+	struct percpu *self;
+	// Top of the stack to switch to on entry from user mode.
+	uint64_t kernel_stack;
+	// Scratch slot for the user RSP while switching stacks on entry.
+	uint64_t user_stack;
+	uint32_t cpu_index;
+	uint8_t lapic_id;
+	// Non-zero while the running code must not be preempted (see
+	// proc/preempt.h).
+	uint32_t preempt_count;
+	preempt_trace_t preempt_trace;
+	// Frequency in HZ of this CPU's LAPIC timer, as measured by
+	// lapic_timer_init.
+	uint32_t lapic_timer_hz;
+	// TSC frequency in HZ, measured alongside the LAPIC timer.
+	uint64_t tsc_hz;
+	// Pending timer events, soonest first, and the deadline the LAPIC timer
+	// is armed with (see hal/timer.h).
+	timer_event_t *timers;
+	uint64_t timer_deadline;
+	// Read-mostly after boot.
+	cpu_topology_t topo;
+	// The task whose extended state was last loaded into this CPU's
+	// registers (see hal/fpu.h).
+	pcb_t *fpu_owner;
+
+	// ltr marks the TSS descriptor busy, so each CPU needs a TSS descriptor,
+	// and so a GDT, of its own.
+	gdt_t gdt __attribute__((aligned(CACHE_LINE_SIZE)));
+	gdt_descriptor_t gdt_desc;
+	tss_t tss __attribute__((aligned(CACHE_LINE_SIZE)));
+
+	// Deferred work queued by this CPU's interrupt handlers.
+	workqueue_t wq;
+
+	// Written by any CPU which queues a task here.
+	run_queue_t rq __attribute__((aligned(CACHE_LINE_SIZE)));
+} __attribute__((aligned(CACHE_LINE_SIZE))) percpu_t;
+
+// Read a field of the current CPU's percpu_t with a single gs-relative load.
+#define percpu_read(field)													\
+	({																		\
+		__typeof__(((percpu_t*) 0)->field) __val;							\
+		__asm__ volatile("mov %%gs:%c1, %0"									\
+			:	"=r"(__val)													\
+			:	"i"(offsetof(percpu_t, field)));							\
+		__val;																\
+	})
+
+// Write a scalar field of the current CPU's percpu_t.
+#define percpu_write(field, val)											\
+	do {																	\
+		__typeof__(((percpu_t*) 0)->field) __val = (val);					\
+		__asm__ volatile("mov %0, %%gs:%c1"									\
+			::	"r"(__val), "i"(offsetof(percpu_t, field))					\
+			:	"memory");													\
+	} while(0)
+
+// Add to a scalar field of the current CPU's percpu_t with a single
+// instruction, so it is safe against interrupts on this CPU.
+#define percpu_add(field, val)												\
+	do {																	\
+		__typeof__(((percpu_t*) 0)->field) __val = (val);					\
+		__asm__ volatile("add %0, %%gs:%c1"									\
+			::	"r"(__val), "i"(offsetof(percpu_t, field))					\
+			:	"memory", "cc");											\
+	} while(0)
+
+/**
+ * Claim the next per-CPU area for the calling CPU and point its GS base at
+ * it. Must run before anything else on each CPU, as locks and interrupt
+ * handlers expect GS to be valid.
+ * @input lapic_id The ID of the calling CPU's LAPIC.
+ * @output The calling CPU's area, NULL, leaving GS alone, if MAX_CPUS CPUs
+ * 		   already have one.
+ */
+percpu_t*
+percpu_init(uint8_t lapic_id);
+
+/**
+ * @output The current CPU's area.
+ */
+static inline percpu_t*
+this_cpu()
+{
+	return percpu_read(self);
+}
+
+/**
+ * @output The index of the current CPU in [0, num_cpus()). The BSP is 0.
+ */
+static inline uint32_t
+cpu_index()
+{
+	return percpu_read(cpu_index);
+}
+
+/**
+ * @input cpu_index Index of a CPU, in [0, num_cpus()).
+ * @output That CPU's area.
+ */
+percpu_t*
+percpu_of(uint32_t cpu_index);
+
+/**
+ * @input lapic_id The ID of a CPU's LAPIC.
+ * @output That CPU's area, NULL if no CPU with that LAPIC ID is online.
+ */
+percpu_t*
+percpu_from_lapic_id(uint8_t lapic_id);
+
+/**
+ * @output The number of CPUs which have called percpu_init.
+ */
+uint32_t
+num_cpus();
+
+#endif
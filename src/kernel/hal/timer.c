@@ -0,0 +1,138 @@
+#include "hal/timer.h"
+#include "hal/cpu.h"
+#include "hal/lapic.h"
+#include "hal/io_apic.h"
+#include "hal/percpu.h"
+
+// CPUID.1:ECX feature bit.
+#define CPUID_1_ECX_TSC_DEADLINE	(1 << 24)
+// The longest one-shot countdown we program, in TSC ticks per TSC HZ. Later
+// deadlines are reached in several interrupts.
+#define MAX_ONE_SHOT_SECONDS		1
+
+static bool TSC_DEADLINE_MODE;
+
+/**
+ * Arm the LAPIC timer for the given TSC deadline, or disarm it.
+ */
+static void
+timer_program(uint64_t deadline)
+{
+	percpu_t *cpu = this_cpu();
+	if(deadline == cpu->timer_deadline) {
+		return;
+	}
+	cpu->timer_deadline = deadline;
+
+	if(TSC_DEADLINE_MODE) {
+		// Writing 0 disarms; a deadline in the past fires immediately.
+		wrmsr(MSR_TSC_DEADLINE, deadline);
+		return;
+	}
+
+	if(deadline == TIMER_NONE) {
+		lapic_write(LAPIC_INIT_COUNT_REG, 0);
+		return;
+	}
+
+	uint64_t now = rdtsc();
+	uint64_t delta = deadline > now ? deadline - now : 0;
+	if(delta > cpu->tsc_hz * MAX_ONE_SHOT_SECONDS) {
+		delta = cpu->tsc_hz * MAX_ONE_SHOT_SECONDS;
+	}
+
+	// The LAPIC counts down once every 8 ticks of its timer frequency.
+	uint64_t count = delta * (cpu->lapic_timer_hz / 8) / cpu->tsc_hz;
+	if(count == 0) {
+		count = 1;
+	} else if(count > 0xFFFFFFFF) {
+		count = 0xFFFFFFFF;
+	}
+	lapic_write(LAPIC_INIT_COUNT_REG, (uint32_t) count);
+}
+
+void
+timer_init()
+{
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	TSC_DEADLINE_MODE = ecx & CPUID_1_ECX_TSC_DEADLINE;
+
+	percpu_t *cpu = this_cpu();
+	cpu->timers			= NULL;
+	cpu->timer_deadline	= TIMER_NONE;
+	lapic_timer_set_mode(TIMER_VECTOR, TSC_DEADLINE_MODE ? TSC_DEADLINE : ONE_SHOT);
+}
+
+uint64_t
+tsc_hz()
+{
+	return percpu_read(tsc_hz);
+}
+
+uint64_t
+us_to_tsc(uint64_t us)
+{
+	return us * (tsc_hz() / 1000000);
+}
+
+void
+timer_add(timer_event_t *event)
+{
+	percpu_t *cpu = this_cpu();
+	timer_event_t **link = &cpu->timers;
+	while(*link && (*link)->deadline <= event->deadline) {
+		link = &(*link)->next;
+	}
+	event->next		= *link;
+	event->armed	= true;
+	*link			= event;
+
+	if(cpu->timers == event) {
+		timer_program(event->deadline);
+	}
+}
+
+void
+timer_remove(timer_event_t *event)
+{
+	if(!event->armed) {
+		return;
+	}
+
+	percpu_t *cpu = this_cpu();
+	timer_event_t **link = &cpu->timers;
+	while(*link && *link != event) {
+		link = &(*link)->next;
+	}
+	if(*link) {
+		*link = event->next;
+	}
+	event->armed	= false;
+	event->next		= NULL;
+
+	// Leaving the old deadline armed would only cost a spurious interrupt,
+	// but idle CPUs should stay quiet.
+	timer_program(cpu->timers ? cpu->timers->deadline : TIMER_NONE);
+}
+
+void
+timer_interrupt()
+{
+	end_of_interrupt(false, TIMER_VECTOR);
+
+	percpu_t *cpu = this_cpu();
+	// The timer has fired, so nothing is armed any more.
+	cpu->timer_deadline = TIMER_NONE;
+
+	uint64_t now = rdtsc();
+	while(cpu->timers && cpu->timers->deadline <= now) {
+		timer_event_t *event = cpu->timers;
+		cpu->timers		= event->next;
+		event->next		= NULL;
+		event->armed	= false;
+		event->callback(event->arg);
+	}
+
+	timer_program(cpu->timers ? cpu->timers->deadline : TIMER_NONE);
+}
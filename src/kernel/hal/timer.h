@@ -0,0 +1,75 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Vector of the per-CPU LAPIC timer interrupt.
+#define TIMER_VECTOR			0x30
+// Deadline meaning "no interrupt".
+#define TIMER_NONE				0
+
+/** Tickless per-CPU timer core.
+ * Each CPU keeps a list of pending events sorted by TSC deadline, and its
+ * LAPIC timer is programmed for the earliest of them only, or not at all if
+ * there are none; there is no periodic tick. The timer runs in TSC-deadline
+ * mode when the CPU supports it, and in one-shot mode otherwise.
+ *
+ * Events belong to the CPU which added them, and must only be added and
+ * removed on that CPU with interrupts disabled. Callbacks run in interrupt
+ * context.
+**/
+
+typedef void (*timer_callback_t)(void *arg);
+
+typedef struct timer_event {
+	// TSC value at or after which callback runs.
+	uint64_t deadline;
+	timer_callback_t callback;
+	void *arg;
+	bool armed;
+	struct timer_event *next;
+} timer_event_t;
+
+/**
+ * Put the calling CPU's LAPIC timer in deadline or one-shot mode, with no
+ * deadline set. Requires lapic_timer_init to have calibrated it.
+ */
+void
+timer_init();
+
+/**
+ * @output The calling CPU's TSC frequency in HZ, as measured alongside the
+ *         LAPIC timer by lapic_timer_init.
+ */
+uint64_t
+tsc_hz();
+
+/**
+ * @input us A duration in microseconds.
+ * @output The duration in TSC ticks of the calling CPU.
+ */
+uint64_t
+us_to_tsc(uint64_t us);
+
+/**
+ * Arm an event on the calling CPU, reprogramming the timer if it is now the
+ * earliest. The event must not already be armed.
+ */
+void
+timer_add(timer_event_t *event);
+
+/**
+ * Disarm an event, if armed, reprogramming the timer if it was the earliest.
+ */
+void
+timer_remove(timer_event_t *event);
+
+/**
+ * Timer interrupt handler: signal EOI, run every expired event, and program
+ * the next deadline.
+ */
+void
+timer_interrupt();
+
+#endif
@@ -0,0 +1,158 @@
+#include "hal/topology.h"
+#include "hal/cpu.h"
+#include "hal/percpu.h"
+#include "acpi/madt.h"
+#include "utils/printf.h"
+
+// Level types reported in ECX[15:8] by CPUID leaves 0xB and 0x1F.
+#define CPUID_LEVEL_INVALID		0
+#define CPUID_LEVEL_SMT			1
+// CPUID.1:EDX feature bit: EBX[23:16] is valid.
+#define CPUID_1_EDX_HTT			(1 << 28)
+// Cache types reported in EAX[4:0] by CPUID leaf 4.
+#define CPUID_4_CACHE_NULL		0
+// MADT processor LAPIC flag.
+#define LAPIC_ENABLED			(1 << 0)
+
+// Shifting an APIC ID right by these gives the core, LLC and package IDs.
+static uint32_t CORE_SHIFT;
+static uint32_t LLC_SHIFT;
+static uint32_t PACKAGE_SHIFT;
+
+static uint32_t
+log2_ceil(uint32_t n)
+{
+	uint32_t shift = 0;
+	while((1u << shift) < n) {
+		++shift;
+	}
+	return shift;
+}
+
+/**
+ * Read the SMT and package shifts from the extended topology leaf, or from
+ * the legacy logical processor count on CPUs without one.
+ */
+static void
+read_apic_id_layout()
+{
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+	uint32_t max_leaf = eax;
+
+	// 0x1F adds module and die levels between core and package; either way
+	// the last level's shift is that of the package ID. A leaf within
+	// max_leaf may still report no levels (EBX 0), as 0x1F does on CPUs and
+	// hypervisors which implement only 0xB, so try 0x1F then 0xB.
+	uint32_t leaf = 0;
+	if(max_leaf >= 0x1F) {
+		cpuid(0x1F, 0, &eax, &ebx, &ecx, &edx);
+		leaf = ebx ? 0x1F : 0;
+	}
+	if(!leaf && max_leaf >= 0xB) {
+		cpuid(0xB, 0, &eax, &ebx, &ecx, &edx);
+		leaf = ebx ? 0xB : 0;
+	}
+
+	if(leaf) {
+		for(uint32_t level = 0;; ++level) {
+			cpuid(leaf, level, &eax, &ebx, &ecx, &edx);
+			uint32_t type = (ecx >> 8) & 0xFF;
+			if(type == CPUID_LEVEL_INVALID) {
+				break;
+			}
+			if(type == CPUID_LEVEL_SMT) {
+				CORE_SHIFT = eax & 0x1F;
+			}
+			PACKAGE_SHIFT = eax & 0x1F;
+		}
+	} else {
+		cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+		uint32_t logical = (edx & CPUID_1_EDX_HTT) ? (ebx >> 16) & 0xFF : 1;
+		// Without leaf 0xB, assume one thread per core.
+		CORE_SHIFT		= 0;
+		PACKAGE_SHIFT	= log2_ceil(logical);
+	}
+
+	// The last level cache is the highest level described by leaf 4. Failing
+	// that (e.g. AMD, which reports caches elsewhere), assume it is shared
+	// package-wide.
+	LLC_SHIFT = PACKAGE_SHIFT;
+	if(max_leaf >= 4) {
+		uint32_t llc_level = 0;
+		for(uint32_t i = 0;; ++i) {
+			cpuid(4, i, &eax, &ebx, &ecx, &edx);
+			if((eax & 0x1F) == CPUID_4_CACHE_NULL) {
+				break;
+			}
+			uint32_t level = (eax >> 5) & 0x7;
+			if(level > llc_level) {
+				llc_level = level;
+				LLC_SHIFT = log2_ceil(((eax >> 14) & 0xFFF) + 1);
+			}
+		}
+	}
+}
+
+void
+topology_init()
+{
+	read_apic_id_layout();
+
+	// Count what the firmware reports, including processors not started.
+	uint64_t cores[4] = { 0 }, packages[4] = { 0 };
+	uint32_t num_threads = 0, num_cores = 0, num_packages = 0;
+	smp_info_t smp_info = get_smp_info();
+	for(size_t i = 0; i < smp_info.num_lapics; ++i) {
+		if(!(smp_info.lapics[i].flags & LAPIC_ENABLED)) {
+			continue;
+		}
+		uint8_t apic_id		= smp_info.lapics[i].apic_id;
+		uint8_t core		= apic_id >> CORE_SHIFT;
+		uint8_t package		= apic_id >> PACKAGE_SHIFT;
+		++num_threads;
+		if(!(cores[core / 64] & (1ull << (core % 64)))) {
+			cores[core / 64] |= 1ull << (core % 64);
+			++num_cores;
+		}
+		if(!(packages[package / 64] & (1ull << (package % 64)))) {
+			packages[package / 64] |= 1ull << (package % 64);
+			++num_packages;
+		}
+	}
+
+	PrintK("Topology: %d packages, %d cores, %d threads (LLC shared by %d)\n",
+			(uint64_t) num_packages, (uint64_t) num_cores,
+			(uint64_t) num_threads, (uint64_t) (1 << LLC_SHIFT));
+}
+
+void
+topology_build()
+{
+	uint32_t n = num_cpus();
+	for(uint32_t i = 0; i < n; ++i) {
+		percpu_t *cpu = percpu_of(i);
+		cpu->topo.core_id		= cpu->lapic_id >> CORE_SHIFT;
+		cpu->topo.llc_id		= cpu->lapic_id >> LLC_SHIFT;
+		cpu->topo.package_id	= cpu->lapic_id >> PACKAGE_SHIFT;
+	}
+
+	for(uint32_t i = 0; i < n; ++i) {
+		cpu_topology_t *topo = &percpu_of(i)->topo;
+		topo->smt_siblings		= CPU_MASK_NONE;
+		topo->llc_siblings		= CPU_MASK_NONE;
+		topo->package_siblings	= CPU_MASK_NONE;
+		for(uint32_t j = 0; j < n; ++j) {
+			cpu_topology_t *other = &percpu_of(j)->topo;
+			if(other->core_id == topo->core_id) {
+				topo->smt_siblings |= cpu_mask_of(j);
+			}
+			if(other->llc_id == topo->llc_id) {
+				topo->llc_siblings |= cpu_mask_of(j);
+			}
+			if(other->package_id == topo->package_id) {
+				topo->package_siblings |= cpu_mask_of(j);
+			}
+		}
+	}
+}
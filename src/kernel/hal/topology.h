@@ -0,0 +1,55 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** CPU masks.
+ * One bit per CPU index (see hal/percpu.h), so MAX_CPUS must not exceed 64.
+**/
+typedef uint64_t cpu_mask_t;
+
+#define CPU_MASK_NONE		0ull
+#define CPU_MASK_ALL		(~0ull)
+#define cpu_mask_of(cpu)	(1ull << (cpu))
+
+// Iterate cpu over the indices set in mask, lowest first.
+#define for_each_cpu(cpu, mask)												\
+	for(cpu_mask_t __m = (mask);											\
+		__m && ((cpu = __builtin_ctzll(__m)), true);						\
+		__m &= __m - 1)
+
+/** Where a CPU sits in the cache hierarchy.
+ * IDs are the corresponding fields of the CPU's APIC ID, as laid out by CPUID
+ * leaf 0x1F (or 0xB): logical processors with equal core IDs are SMT
+ * siblings, sharing a core and its L1/L2 caches, and those with equal LLC IDs
+ * share the last level cache.
+**/
+typedef struct {
+	uint32_t core_id;
+	uint32_t llc_id;
+	uint32_t package_id;
+	// Masks of online CPUs, including this one, with the same core, last
+	// level cache and package.
+	cpu_mask_t smt_siblings;
+	cpu_mask_t llc_siblings;
+	cpu_mask_t package_siblings;
+} cpu_topology_t;
+
+/**
+ * Find how APIC IDs split into SMT, core and package fields, and which of them
+ * share the last level cache, then summarise the processors listed in the
+ * MADT. Must run on the BSP after ParseMadt; every CPU is assumed to report
+ * the same layout.
+ */
+void
+topology_init();
+
+/**
+ * Fill in the topology of every CPU which has called percpu_init. Must run
+ * once all APs are online, and before tasks are scheduled.
+ */
+void
+topology_build();
+
+#endif
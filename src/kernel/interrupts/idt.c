@@ -4,11 +4,25 @@
 #include "utils/printf.h"
 #include "hal/io_apic.h"
 #include "hal/pit.h"
+#include "proc/sched.h"
+#include "proc/workqueue.h"
+#include "utils/spin_lock.h"
 #include <stdbool.h>
 
+// Key presses buffered between the keyboard ISR and the worker which passes
+// them to the keystroke consumer. Must be a power of 2.
+#define KEY_BUFFER_SIZE	64
+
 static IdtEntry IDT[256];
 static volatile KeyInfo KEY_INFO;
 
+static KeyInfo KEY_BUFFER[KEY_BUFFER_SIZE];
+static uint32_t KEY_BUFFER_HEAD, KEY_BUFFER_TAIL;
+static spin_lock_t KEY_BUFFER_LOCK;
+
+static void deliver_keys(work_t *work);
+static work_t KEY_WORK = WORK_INIT(&deliver_keys);
+
 
 void InitializeIdt() 
 {
@@ -18,10 +32,30 @@ void InitializeIdt()
 	SetIdtEntry(0x22, (void*) isr2, INTERRUPT_GATE);
 	// Syscall (IRQ 0x80).
 	SetIdtEntry(0x80, (void*) isr80, INTERRUPT_GATE | USER_MODE_INT);
-
-	// Register print/exit syscalls.
+	// Timer events (including preemption) and reschedule IPIs.
+	SetIdtEntry(TIMER_VECTOR, (void*) isr_sched_timer, INTERRUPT_GATE);
+	SetIdtEntry(RESCHED_VECTOR, (void*) isr_resched, INTERRUPT_GATE);
+	// Device not available, i.e. lazy FPU restore.
+	SetIdtEntry(0x07, (void*) isr_nm, INTERRUPT_GATE);
+	// Page faults, i.e. demand paging of process images.
+	SetIdtEntry(0x0E, (void*) isr_pf, INTERRUPT_GATE);
+
+	// Register print/yield/getpid/thread_create/spawn/exit/getppid/
+	// arch_prctl/gettid/setaffinity syscalls.
 	register_syscall(0x01, &syscall_1);
+	register_syscall(0x18, &syscall_18);
+	register_syscall(0x27, &syscall_27);
+	register_syscall(0x38, &syscall_38);
+	register_syscall(0x3b, &syscall_3b);
 	register_syscall(0x3c, &syscall_3c);
+	register_syscall(0x6e, &syscall_6e);
+	register_syscall(0x9e, &syscall_9e);
+	register_syscall(0xa9, &syscall_a9);
+	register_syscall(0xaa, &syscall_aa);
+	register_syscall(0xba, &syscall_ba);
+	register_syscall(0xcb, &syscall_cb);
+	register_syscall(0xe3, &syscall_e3);
+	register_syscall(0xe4, &syscall_e4);
 		
 	// Due to historical quirks, IBM already maps ISRs [0x0,0x1F] to various
 	// hardware interrupts. This conflicts with IRQs, which occupy part of the
@@ -137,10 +171,17 @@ void Isr1Handler()
 			break;
 	}
 	
-	// Only notify on key presses, not on key releases.
+	// Only notify on key presses, not on key releases. The consumer renders
+	// to the framebuffer, which is far too slow for an interrupt handler, so
+	// leave that to a worker.
 	if(KEY_INFO.scancode < 0x80) {
-		KeystrokeConsumer ks_consumer = GetKeystrokeConsumer();
-		ks_consumer(&KEY_INFO);
+		spin_lock(&KEY_BUFFER_LOCK);
+		// If the worker has fallen this far behind, drop the key.
+		if(KEY_BUFFER_TAIL - KEY_BUFFER_HEAD < KEY_BUFFER_SIZE) {
+			KEY_BUFFER[KEY_BUFFER_TAIL++ % KEY_BUFFER_SIZE] = KEY_INFO;
+		}
+		spin_unlock(&KEY_BUFFER_LOCK);
+		queue_work(&KEY_WORK);
 	}
 
 	// Tell PIC to resume interrupts now that we've handled this one.
@@ -148,6 +189,28 @@ void Isr1Handler()
 	end_of_interrupt(false, 0x21);
 }
 
+/**
+ * Pass buffered key presses to the keystroke consumer, outside interrupt
+ * context.
+ */
+static void deliver_keys(work_t *work)
+{
+	for(;;) {
+		uint64_t rflags = spin_lock_irqsave(&KEY_BUFFER_LOCK);
+		if(KEY_BUFFER_HEAD == KEY_BUFFER_TAIL) {
+			spin_unlock_irqrestore(&KEY_BUFFER_LOCK, rflags);
+			return;
+		}
+		KeyInfo key_info = KEY_BUFFER[KEY_BUFFER_HEAD++ % KEY_BUFFER_SIZE];
+		spin_unlock_irqrestore(&KEY_BUFFER_LOCK, rflags);
+
+		KeystrokeConsumer ks_consumer = GetKeystrokeConsumer();
+		if(ks_consumer) {
+			ks_consumer(&key_info);
+		}
+	}
+}
+
 void Isr2Handler()
 {
 	void (*timer_handler)(void) = get_timer_handler();
@@ -57,6 +57,12 @@ extern void 	isr1();
 // ISR2 (timer) handler from asm file.
 extern void		isr2();
 extern void		isr80();
+// Timer, reschedule IPI and #NM (lazy FPU) stubs.
+extern void		isr_sched_timer();
+extern void		isr_resched();
+extern void		isr_nm();
+// Page fault stub, for demand paging.
+extern void		isr_pf();
 
 // Loads the IDT referenced by given IDT descriptor as the IDT. 
 extern void 	LoadIdt(uint64_t idtr);
@@ -42,26 +42,122 @@
 	pop rax
 %endmacro
 
+; Interrupts from user mode arrive with the user's GS base loaded; swap in
+; the kernel's per-CPU GS base (see hal/percpu.h). Must be used while the
+; interrupt frame is on top of the stack, i.e. before any push on entry and
+; after every pop on exit, and must be paired in both places.
+%macro SWAPGS_IF_USER 0
+	; RPL of the saved CS.
+	test qword [rsp+8], 3
+	jz %%from_kernel
+	swapgs
+%%from_kernel:
+%endmacro
+
+; Preempt the interrupted task if a reschedule is pending and it is safe to
+; (see sched_irq_exit). Must be used after PUSHALL, with the trap frame on top
+; of the stack.
+[extern sched_irq_exit]
+%macro PREEMPT_POINT 0
+	mov rdi, rsp
+	call sched_irq_exit
+%endmacro
+
 GLOBAL isr1
 [extern Isr1Handler]
 isr1:
+	SWAPGS_IF_USER
 	PUSHALL
 	call Isr1Handler
+	PREEMPT_POINT
 	POPALL
+	SWAPGS_IF_USER
 	iretq
 
 GLOBAL isr2
 [extern Isr2Handler]
 isr2:
+	SWAPGS_IF_USER
 	PUSHALL
 	call Isr2Handler
+	PREEMPT_POINT
 	POPALL
+	SWAPGS_IF_USER
+	iretq
+
+GLOBAL isr_sched_timer
+[extern sched_timer_handler]
+; LAPIC timer. If the slice ended, PREEMPT_POINT may switch_to another task,
+; in which case we return here, and iret to this task, when it is next
+; scheduled.
+isr_sched_timer:
+	SWAPGS_IF_USER
+	PUSHALL
+	call sched_timer_handler
+	PREEMPT_POINT
+	POPALL
+	SWAPGS_IF_USER
+	iretq
+
+GLOBAL isr_resched
+[extern sched_resched_handler]
+; Reschedule IPI from another CPU.
+isr_resched:
+	SWAPGS_IF_USER
+	PUSHALL
+	call sched_resched_handler
+	PREEMPT_POINT
+	POPALL
+	SWAPGS_IF_USER
+	iretq
+
+GLOBAL isr_nm
+[extern fpu_trap_handler]
+; Device not available (#NM): first FPU/SSE use since CR0.TS was set.
+isr_nm:
+	SWAPGS_IF_USER
+	PUSHALL
+	call fpu_trap_handler
+	POPALL
+	SWAPGS_IF_USER
+	iretq
+
+GLOBAL isr_pf
+[extern vm_fault_handler]
+; Page fault (#PF). The CPU pushes an error code after the interrupt frame, so
+; the saved CS is one slot further up than SWAPGS_IF_USER expects on entry.
+isr_pf:
+	test qword [rsp+16], 3
+	jz .from_kernel
+	swapgs
+.from_kernel:
+	PUSHALL
+	mov rdi, rsp
+	mov rsi, [rsp+120]
+	mov rdx, cr2
+	call vm_fault_handler
+	POPALL
+	; Drop the error code.
+	add rsp, 8
+	SWAPGS_IF_USER
+	iretq
+
+GLOBAL task_entry_trampoline
+[extern sched_switch_done]
+; Where the first switch_to into a new task returns to. The task's kernel
+; stack holds the trap frame built by init_task_context, which we "return"
+; through into user mode.
+task_entry_trampoline:
+	call sched_switch_done
+	POPALL
+	SWAPGS_IF_USER
 	iretq
 
 GLOBAL isr80
 [extern Isr80Handler]
 ; Syscall. 
 isr80:
+	SWAPGS_IF_USER
 	; This PUSHALL will be popped inside SAVE_REGISTERS.
 	PUSHALL
 
@@ -70,16 +166,62 @@ isr80:
 	lea rsi, [rsp+120]
 	mov rdi, rsp
 
+	; FS and GS bases live in MSRs; reloading their selectors would clobber
+	; them.
 	mov ax, 0x30
 	mov ds, ax
-	mov fs, ax
 	mov ss, ax
-	mov gs, ax
 	mov es, ax
 
 	call Isr80Handler
+	PREEMPT_POINT
+
+	POPALL
+	SWAPGS_IF_USER
+	iretq
+
+; Fields of percpu_t (see hal/percpu.h), and GDT selectors (see gdt/gdt.h).
+%define PERCPU_KERNEL_STACK	0x08
+%define PERCPU_USER_STACK	0x10
+%define USER_DS_SEGSEL		0x3B
+%define USER_CS_SEGSEL		0x43
+; sysret faults in ring 0 if RCX isn't canonical, so returns to addresses
+; above the last user page go through iretq, which faults in ring 3.
+%define SYSRET_RIP_LIMIT	0x00007ffffffff000
+
+GLOBAL syscall_entry
+; syscall instruction (see interrupts/syscall.h). The CPU has put the user RIP
+; in RCX and RFLAGS in R11, and masked interrupts through SFMASK, but left RSP
+; as it was, so switch to the task's kernel stack and build the interrupt frame
+; isr80 would have got. Everything after, i.e. the handlers, PREEMPT_POINT and
+; context switches, sees the same trap frame either way.
+syscall_entry:
+	swapgs
+	mov [gs:PERCPU_USER_STACK], rsp
+	mov rsp, [gs:PERCPU_KERNEL_STACK]
+	push qword USER_DS_SEGSEL
+	push qword [gs:PERCPU_USER_STACK]
+	push r11
+	push qword USER_CS_SEGSEL
+	push rcx
+	PUSHALL
+
+	lea rsi, [rsp+120]
+	mov rdi, rsp
+	call Isr80Handler
+	PREEMPT_POINT
 
 	POPALL
+	mov rcx, [rsp]
+	mov r11, SYSRET_RIP_LIMIT
+	cmp rcx, r11
+	jae .iret
+	mov r11, [rsp+16]
+	mov rsp, [rsp+24]
+	swapgs
+	o64 sysret
+.iret:
+	swapgs
 	iretq
 
 GLOBAL LoadIdt 
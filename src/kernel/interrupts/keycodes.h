@@ -15,6 +15,7 @@
 #define RIGHT_SHIFT_RELEASED	0xB6
 #define CTRL_PRESSED			0x1E
 #define CTRL_RELEASED			0x9E
+#define F12_PRESSED				0x58
 
 // Struct to provide information about the current keyboard state.
 typedef struct {
@@ -1,31 +1,196 @@
 #include "interrupts/syscall.h"
+#include "gdt/gdt.h"
+#include "hal/cpu.h"
 #include "graphics/terminal.h"
 #include "proc/sched.h"
+#include "proc/spawn.h"
+#include "proc/image_cache.h"
+#include "proc/ptable.h"
+#include "proc/thread.h"
+#include "proc/uring.h"
+#include "proc/vdso.h"
+#include "memory_management/vm_region.h"
 #include "utils/printf.h"
+#include "utils/seq_lock.h"
 
-static syscall_handler_t SYSCALLS[256];
+#define NUM_SYSCALLS	256
+
+#define NS_PER_SECOND	1000000000ull
+
+// arch_prctl codes.
+#define ARCH_SET_FS		0x1002
+
+// Handlers are registered at boot and looked up on every syscall, on every
+// CPU, so readers go through a seqlock and never write to shared memory.
+static syscall_handler_t SYSCALLS[NUM_SYSCALLS];
+static seq_lock_t SYSCALLS_LOCK;
 
 __attribute__((sysv_abi))
-void Isr80Handler(const registers_t *const regs, const control_registers_t *const cregs)
+void Isr80Handler(registers_t *const regs, const control_registers_t *const cregs)
 {
-	syscall_handler_t handler = SYSCALLS[regs->rax];
-	(*handler)(regs);
-	return;
+	if(regs->rax >= NUM_SYSCALLS)
+		return;
+
+	syscall_handler_t handler;
+	uint32_t seq;
+	do {
+		seq = read_seqbegin(&SYSCALLS_LOCK);
+		handler = SYSCALLS[regs->rax];
+	} while(read_seqretry(&SYSCALLS_LOCK, seq));
+
+	if(handler)
+		(*handler)(regs);
 }
 
 
+extern void syscall_entry();
+
+void syscall_init()
+{
+	// syscall loads CS from STAR[47:32] and SS from the descriptor after it;
+	// sysret loads SS from the descriptor after STAR[63:48] and CS from the
+	// one after that.
+	wrmsr(MSR_STAR, (uint64_t) (KERN_DS_SEGSEL | 3) << 48 | (uint64_t) KERN_CS_SEGSEL << 32);
+	wrmsr(MSR_LSTAR, (uintptr_t) &syscall_entry);
+	// Enter with interrupts masked, as through isr80's interrupt gate.
+	wrmsr(MSR_SFMASK, RFLAGS_TF | RFLAGS_IF | RFLAGS_DF | RFLAGS_NT | RFLAGS_AC);
+	wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+}
+
 void register_syscall(uint64_t rax, syscall_handler_t handler)
 {
+	if(rax >= NUM_SYSCALLS)
+		return;
+
+	uint64_t rflags = write_seqlock(&SYSCALLS_LOCK);
 	SYSCALLS[rax] = handler;
+	write_sequnlock(&SYSCALLS_LOCK, rflags);
+}
+
+void syscall_1(registers_t *const regs)
+{
+	PrintK((char*)regs->rsi);
+}
+
+// sched_yield.
+void syscall_18(registers_t *const regs)
+{
+	context_switch();
+}
+
+// spawn: run the initrd executable named by the string at rdi in a new
+// process (see proc/spawn.h). Returns its PID, or -1.
+void syscall_3b(registers_t *const regs)
+{
+	char path[IMAGE_NAME_LEN];
+	process_t *proc = current_task()->proc;
+	if(!vm_copy_string_in(proc, path, (const char*) regs->rdi, sizeof(path))) {
+		regs->rax = -1;
+		return;
+	}
+	regs->rax = spawn(path, proc);
+}
+
+// getpid.
+void syscall_27(registers_t *const regs)
+{
+	regs->rax = current_task()->proc->pid;
 }
 
-void syscall_1(const registers_t *const regs)
+// thread_create: start a thread of the calling process at rdi, with rsi as
+// its argument (see proc/thread.h). Returns its thread ID, or -1.
+void syscall_38(registers_t *const regs)
 {
-	PrintK((char*)regs->r8);
+	regs->rax = thread_create(regs->rdi, regs->rsi);
 }
 
-void syscall_3c(const registers_t *const regs)
+void syscall_3c(registers_t *const regs)
 {
-	for(;;);
-	return;
+	exit_current_task();
+}
+
+// getppid: 0 once the parent has been reaped.
+void syscall_6e(registers_t *const regs)
+{
+	regs->rax = current_task()->proc->ppid;
+}
+
+// arch_prctl, ARCH_SET_FS only: set the calling thread's FS base to rsi.
+// Returns 0, or -1 for other codes or a non-user address.
+void syscall_9e(registers_t *const regs)
+{
+	if(regs->rdi != ARCH_SET_FS || regs->rsi >= USER_SPACE_END) {
+		regs->rax = -1;
+		return;
+	}
+	set_fs_base(regs->rsi);
+	regs->rax = 0;
+}
+
+// uring_setup: set up the calling process' rings with rdi SQEs and the
+// URING_SETUP_* flags in rsi (see proc/uring.h). Returns where they are
+// mapped, or -1. Linux numbers it 0x1a9, past NUM_SYSCALLS.
+void syscall_a9(registers_t *const regs)
+{
+	regs->rax = uring_setup(regs->rdi, regs->rsi);
+}
+
+// uring_enter: run the calling process' queued SQEs, then wait for rdi CQEs.
+// Returns the number of SQEs consumed, or -1.
+void syscall_aa(registers_t *const regs)
+{
+	regs->rax = uring_enter(regs->rdi);
+}
+
+// gettid.
+void syscall_ba(registers_t *const regs)
+{
+	regs->rax = current_task()->tid;
+}
+
+// clock_settime, CLOCK_REALTIME only, to the timespec at rsi (see
+// proc/vdso.h). Returns 0, or -1 for other clocks or a bad timespec.
+void syscall_e3(registers_t *const regs)
+{
+	uint64_t ts[2];
+	if(regs->rdi != CLOCK_REALTIME ||
+	   !vm_copy_in(current_task()->proc, ts, regs->rsi, sizeof(ts)) ||
+	   ts[1] >= NS_PER_SECOND || ts[0] > UINT64_MAX / NS_PER_SECOND - 1)
+	{
+		regs->rax = -1;
+		return;
+	}
+	vdso_set_realtime(ts[0] * NS_PER_SECOND + ts[1]);
+	regs->rax = 0;
+}
+
+// clock_gettime: store clock rdi's time at rsi, as the vDSO's does without
+// entering the kernel. Returns 0, or -1.
+void syscall_e4(registers_t *const regs)
+{
+	uint64_t ns;
+	if(!vdso_clock_ns(regs->rdi, &ns)) {
+		regs->rax = -1;
+		return;
+	}
+	uint64_t ts[2] = { ns / NS_PER_SECOND, ns % NS_PER_SECOND };
+	regs->rax = vm_copy_out(current_task()->proc, regs->rsi, ts, sizeof(ts)) ? 0 : -1;
+}
+
+// sched_setaffinity for the thread rdi (0 for the caller), with the mask
+// passed by value. Returns 0, or -1 if there is no such thread or the mask
+// allows no online CPU.
+void syscall_cb(registers_t *const regs)
+{
+	// The caller may have to switch CPUs, which it can't with the table locked.
+	pcb_t *self = current_task();
+	if(regs->rdi == 0 || regs->rdi == self->tid) {
+		regs->rax = sched_set_affinity(self, regs->rsi) ? 0 : -1;
+		return;
+	}
+
+	uint64_t rflags = ptable_lock();
+	pcb_t *task = ptable_find(regs->rdi);
+	regs->rax = task && sched_set_affinity(task, regs->rsi) ? 0 : -1;
+	ptable_unlock(rflags);
 }
@@ -10,11 +10,11 @@ typedef struct {
 	uint64_t	r13;
 	uint64_t	r12;
 	uint64_t	r11;
-	uint64_t	rsi;
-	uint64_t	rbp;
 	uint64_t	r10;
 	uint64_t	r9;
 	uint64_t	r8;
+	uint64_t	rbp;
+	uint64_t	rsi;
 	uint64_t	rdi;
 	uint64_t	rdx;
 	uint64_t	rcx;
@@ -30,15 +30,43 @@ typedef struct {
 	uint32_t	ds;
 } __attribute__((packed)) control_registers_t;
 
-typedef void(*syscall_handler_t)(const registers_t* const);
+// Handlers return values by setting regs->rax, which is restored to the
+// caller on return.
+typedef void(*syscall_handler_t)(registers_t* const);
+
+/** Syscalls are entered through the syscall instruction, or, for
+ * compatibility, int 0x80; both take the number in RAX and arguments in RDI,
+ * RSI, RDX, and return in RAX. syscall saves no registers in memory and loads
+ * no descriptors, so it is several times cheaper, but clobbers RCX and R11.
+ * syscall_entry builds the same trap frame on the kernel stack as int 0x80
+ * gets, so handlers, preemption and context switches can't tell them apart.
+**/
 
 __attribute__((sysv_abi))
-void Isr80Handler(const registers_t *const regs, const control_registers_t *const cregs);
+void Isr80Handler(registers_t *const regs, const control_registers_t *const cregs);
+
+/**
+ * Enable the syscall instruction on the calling CPU. Must run after its GDT
+ * is loaded.
+ */
+void syscall_init();
 
 void register_syscall(uint64_t rax, syscall_handler_t handler);
 
 
-void syscall_1(const registers_t *const regs);
-void syscall_3c(const registers_t *const regs);
+void syscall_1(registers_t *const regs);
+void syscall_18(registers_t *const regs);
+void syscall_27(registers_t *const regs);
+void syscall_38(registers_t *const regs);
+void syscall_3b(registers_t *const regs);
+void syscall_3c(registers_t *const regs);
+void syscall_6e(registers_t *const regs);
+void syscall_9e(registers_t *const regs);
+void syscall_a9(registers_t *const regs);
+void syscall_aa(registers_t *const regs);
+void syscall_ba(registers_t *const regs);
+void syscall_cb(registers_t *const regs);
+void syscall_e3(registers_t *const regs);
+void syscall_e4(registers_t *const regs);
 
 #endif
@@ -148,6 +148,7 @@ void *stivale2_get_tag(struct stivale2_struct *stivale2_struct, uint64_t id) {
 
 //#include "kernel/interrupts/idt.h"
 #include "interrupts/idt.h"
+#include "interrupts/syscall.h"
 #include "graphics/graphics_ctx.h"
 struct stivale2_struct_tag_terminal *term_str_tag_g;
 #include "interrupts/keycodes.h"
@@ -161,6 +162,10 @@ static Font *global_font;
 #include "utils/printf.h"
 #include "acpi/acpi.h"
 #include "hal/cpu_init.h"
+#include "hal/cpu.h"
+#include "hal/percpu.h"
+#include "hal/fpu.h"
+#include "hal/topology.h"
 #include "hal/lapic.h"
 #include "hal/io_apic.h"
 #include "memory_management/kheap.h"
@@ -168,6 +173,12 @@ static Font *global_font;
 #include "vfs/ustar.h"
 #include "proc/sched.h"
 #include "proc/elf.h"
+#include "proc/spawn.h"
+#include "vfs/initrd.h"
+#include "proc/workqueue.h"
+#include "proc/sched_trace.h"
+#include "proc/sched_bench.h"
+#include "proc/vdso.h"
 Terminal term;
 
 void (*term_write)(const char *string, size_t length);
@@ -180,9 +191,28 @@ void print_key(KeyInfo *key_info)
 	PrintK(c);
 }
 
+// Unused by benchmarks which spawn nothing.
+static __attribute__((unused)) void
+spawn_copies(const char *path, uint32_t copies)
+{
+	for(uint32_t i = 0; i < copies; ++i) {
+		if(spawn(path, NULL) < 0) {
+			PrintK("Could not spawn %s.\n", path);
+			return;
+		}
+	}
+}
+
 void _start(struct stivale2_struct *stivale2_struct) {
 	__asm__("cli");
 
+	// Set up the BSP's per-CPU area before anything can touch it. The LAPIC
+	// isn't mapped yet, so take the APIC ID from CPUID.
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	percpu_init(ebx >> 24);
+	fpu_init();
+
 	struct stivale2_struct_tag_modules *mods;
 	mods = stivale2_get_tag(stivale2_struct, STIVALE2_STRUCT_TAG_MODULES_ID);
 
@@ -217,6 +247,7 @@ void _start(struct stivale2_struct *stivale2_struct) {
 
 	InitAcpi(*rsdp_addr_tag);
 	ParseMadt();
+	topology_init();
 	InitPageTable(memmap, kern_base_addr, pmrs);
 	InitializeIdt();
 
@@ -224,21 +255,24 @@ void _start(struct stivale2_struct *stivale2_struct) {
 	init_heap(0x20000);
 	enable_lapic();
 	initialize_gdt((uint64_t) &stack + sizeof(stack));
+	syscall_init();
+	vdso_cpu_init();
 	unmask_irq(0x2);
 	startup_aps(smp_info);
 	mask_irq(0x2);
+	vdso_init();
+	topology_build();
+	global_init_scheduler(num_cpus());
+	workqueue_init();
+	sched_trace_init();
 	
 	void *initrd = ustar_from_module(mods, "boot:///initrd.ustar");
-	char *fetch;
 	if(initrd) {
-		fetch = ustar_read(initrd, "./userspace/fetch.elf");
+		initrd_mount(initrd);
 	}
 
 	__asm__("sti");
 
-	pcb_t fetch_pcb;
-	parse_elf((char*) fetch, &fetch_pcb);
-
 	//PrintK("BSP Lapic ID is 0x%h\n", smp_info->bsp_lapic_id);
 	//void *a = kalloc(20);
 
@@ -271,12 +305,30 @@ void _start(struct stivale2_struct *stivale2_struct) {
 	
 	unmask_irq(0x1);
 	SetKeystrokeConsumer(&HandleKeyStroke);
-	// This bit is run in the final report.
-	//run_proc(&fetch_pcb);
+#ifdef SCHED_BENCH
+	// Two copies of the benchmark yield to each other; run with -smp 1 so
+	// that they share a CPU (see "make bench-ctxsw").
+	spawn_copies("./userspace/ctxsw_bench.elf", 2);
+#elif defined(SPAWN_BENCH)
+	// See "make bench-spawn".
+	spawn_copies("./userspace/spawn_bench.elf", 1);
+#elif defined(SYSCALL_BENCH)
+	// See "make bench-syscall".
+	spawn_copies("./userspace/syscall_bench.elf", 1);
+#elif defined(URING_BENCH)
+	// See "make bench-uring".
+	spawn_copies("./userspace/uring_bench.elf", 1);
+#elif defined(CLOCK_BENCH)
+	// See "make bench-clock".
+	spawn_copies("./userspace/clock_bench.elf", 1);
+#elif defined(FAIRNESS_BENCH)
+	// See "make bench-fairness".
+	fairness_bench_start();
+#else
+	// Give every CPU a copy of fetch to run.
+	spawn_copies("./userspace/fetch.elf", num_cpus());
+#endif
 
 	__asm__("sti");
-
-    for (;;) {
-        asm ("hlt");
-    }
+	sched_idle();
 }
@@ -0,0 +1,149 @@
+#include "memory_management/arena.h"
+#include "memory_management/physical_memory_manager.h"
+#include "memory_management/virtual_memory_manager.h"
+#include "utils/misc.h"
+#include "utils/string.h"
+
+static arena_t *BOOT_ARENA;
+
+static arena_chunk_t*
+alloc_chunk(size_t size);
+
+static void
+free_chunk(arena_chunk_t *chunk);
+
+static inline size_t
+align_up(size_t value)
+{
+	return RoundToNearestMultiple(value, ARENA_ALIGNMENT);
+}
+
+arena_t*
+arena_create(size_t chunk_size)
+{
+	size_t header_size = align_up(sizeof(arena_chunk_t)) +
+						 align_up(sizeof(arena_t));
+	chunk_size = RoundToNearestMultiple(chunk_size ? chunk_size : 1, FRAME_SIZE);
+
+	arena_chunk_t *chunk = alloc_chunk(chunk_size);
+	if(!chunk) {
+		return NULL;
+	}
+
+	// The arena is the first allocation in its own first chunk.
+	arena_t *arena 		= (arena_t*) ((uintptr_t) chunk +
+									  align_up(sizeof(arena_chunk_t)));
+	chunk->used			= header_size;
+	arena->head 		= chunk;
+	arena->chunk_size	= chunk_size;
+	return arena;
+}
+
+void*
+arena_alloc(arena_t *arena, size_t size)
+{
+	size = align_up(size);
+	arena_chunk_t *chunk = arena->head;
+
+	// Only the newest chunk is ever bumped; whatever is left at the end of
+	// older chunks is wasted until the next reset.
+	if(chunk->used + size > chunk->size) {
+		size_t needed = align_up(sizeof(arena_chunk_t)) + size;
+		size_t new_size = needed > arena->chunk_size ?
+						  RoundToNearestMultiple(needed, FRAME_SIZE) :
+						  arena->chunk_size;
+
+		chunk = alloc_chunk(new_size);
+		if(!chunk) {
+			return NULL;
+		}
+		chunk->next	= arena->head;
+		arena->head	= chunk;
+	}
+
+	void *allocation = (void*) ((uintptr_t) chunk + chunk->used);
+	chunk->used += size;
+	return allocation;
+}
+
+void
+arena_reset(arena_t *arena)
+{
+	// Walk to the first chunk, which holds the arena, freeing the rest.
+	arena_chunk_t *chunk = arena->head;
+	while(chunk->next) {
+		arena_chunk_t *next = chunk->next;
+		free_chunk(chunk);
+		chunk = next;
+	}
+
+	size_t header_size = align_up(sizeof(arena_chunk_t)) +
+						 align_up(sizeof(arena_t));
+	// Allocations are handed out zeroed, so clear what was used.
+	memset((void*) ((uintptr_t) chunk + header_size), 0,
+		   chunk->used - header_size);
+	chunk->used	= header_size;
+	arena->head	= chunk;
+}
+
+void
+arena_destroy(arena_t *arena)
+{
+	arena_chunk_t *chunk = arena->head;
+	while(chunk) {
+		arena_chunk_t *next = chunk->next;
+		free_chunk(chunk);
+		chunk = next;
+	}
+}
+
+arena_t*
+boot_arena()
+{
+	if(!BOOT_ARENA) {
+		BOOT_ARENA = arena_create(FRAME_SIZE);
+	}
+	return BOOT_ARENA;
+}
+
+void*
+boot_alloc(size_t size)
+{
+	arena_t *arena = boot_arena();
+	return arena ? arena_alloc(arena, size) : NULL;
+}
+
+/**
+ * Allocate a zeroed chunk of contiguous frames, addressed through the higher
+ * half so that it remains accessible from process page tables.
+ * @input size The size of the chunk in bytes; a multiple of FRAME_SIZE.
+ * @output The chunk, with its header filled, or NULL if no frames are free.
+ */
+static arena_chunk_t*
+alloc_chunk(size_t size)
+{
+	void *frames = AllocContiguous(size);
+	if(!frames) {
+		return NULL;
+	}
+
+	arena_chunk_t *chunk 	= (arena_chunk_t*) ((uintptr_t) frames + KERNEL_DATA);
+	chunk->next				= NULL;
+	chunk->size				= size;
+	chunk->used				= align_up(sizeof(arena_chunk_t));
+	return chunk;
+}
+
+/**
+ * Return each frame of a chunk to the PMM.
+ * @input chunk The chunk to free.
+ */
+static void
+free_chunk(arena_chunk_t *chunk)
+{
+	uintptr_t frames = (uintptr_t) chunk - KERNEL_DATA;
+	size_t size = chunk->size;
+	for(size_t off = 0; off < size; off += FRAME_SIZE) {
+		FreeFrame((void*) (frames + off));
+	}
+}
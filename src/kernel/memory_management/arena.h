@@ -0,0 +1,79 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Alignment of every pointer returned by arena_alloc.
+#define ARENA_ALIGNMENT		16
+
+// Arenas are backed by chunks of contiguous page frames. Each chunk begins
+// with this header, and allocations are carved from the rest of the chunk by
+// bumping "used".
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+	// Size of the chunk in bytes, including this header.
+	size_t size;
+	// Offset of the first unallocated byte from the start of the chunk.
+	size_t used;
+} arena_chunk_t;
+
+// An arena lives in its own first chunk, so creating one needs nothing but
+// the PMM; chunks are chained newest-first, with the first chunk at the tail.
+typedef struct {
+	arena_chunk_t *head;
+	// Minimum size of newly-added chunks.
+	size_t chunk_size;
+} arena_t;
+
+/**
+ * Create an arena backed by page frames from the PMM.
+ * @input chunk_size The minimum number of bytes to request from the PMM at a
+ * 					 time. Rounded up to a multiple of the frame size.
+ * @output The arena, NULL if the PMM is out of frames.
+ */
+arena_t*
+arena_create(size_t chunk_size);
+
+/**
+ * Allocate memory from an arena. The memory is zeroed and aligned to
+ * ARENA_ALIGNMENT; it is released only by arena_reset or arena_destroy.
+ * @input arena The arena from which to allocate.
+ * @input size The number of bytes to allocate.
+ * @output Ptr to the allocation, NULL if the PMM is out of frames.
+ */
+void*
+arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * Release every allocation in an arena at once. Chunks beyond the first are
+ * returned to the PMM.
+ * @input arena The arena to reset.
+ */
+void
+arena_reset(arena_t *arena);
+
+/**
+ * Return every chunk of an arena, including the one holding the arena itself,
+ * to the PMM.
+ * @input arena The arena to destroy. Not valid after this call.
+ */
+void
+arena_destroy(arena_t *arena);
+
+/**
+ * The boot arena holds allocations which live for the lifetime of the kernel
+ * and are made before init_heap (e.g. ACPI tables). It is created on first
+ * use, and requires only that the PMM be initialized.
+ * @output The boot arena.
+ */
+arena_t*
+boot_arena();
+
+/**
+ * Shorthand for arena_alloc(boot_arena(), size).
+ */
+void*
+boot_alloc(size_t size);
+
+#endif
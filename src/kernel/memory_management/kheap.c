@@ -3,12 +3,36 @@
 #include "memory_management/virtual_memory_manager.h"
 #include "utils/string.h"
 #include "utils/printf.h"
+#include "utils/spin_lock.h"
 
 static const size_t HEADER_SIZE = sizeof(uint32_t);
 static const size_t FOOTER_SIZE = sizeof(uint32_t);
 static const size_t MDATA_SIZE	= sizeof(uint32_t) * 2;
 static void *HEAP_START;
 static size_t HEAP_SIZE;
+// Tasks are created on one CPU and torn down on another.
+static spin_lock_t HEAP_LOCK;
+
+// Heap profiling. Every live allocation is remembered in an open-addressed
+// table keyed by its address, so that kfree can credit the bytes back to the
+// call site which allocated them. A slot whose alloc is TOMBSTONE has been
+// freed and may be reused, but does not terminate a probe sequence.
+#define HEAP_PROFILE_LIVE	1024
+#define TOMBSTONE			((void*) 1)
+
+typedef struct {
+	void		*alloc;
+	uint32_t	size;
+	uint16_t	site;
+} live_alloc_t;
+
+static heap_site_stats_t SITES[HEAP_PROFILE_SITES];
+static size_t NUM_SITES;
+static live_alloc_t LIVE_ALLOCS[HEAP_PROFILE_LIVE];
+static size_t LIVE_BYTES;
+static size_t PEAK_BYTES;
+static size_t LIVE_COUNT;
+static uint64_t UNTRACKED;
 
 static inline uint32_t*
 footer_from_header(uint32_t const *header);
@@ -43,12 +67,24 @@ merge_backward(void *first_block, void *second_block, size_t size);
 static inline void*
 threeway_merge(void *front, void *middle, void *back, size_t size);
 
-static inline void
-print_allocations();
+static void*
+heap_alloc(size_t size);
+
+static void
+heap_free(void *allocation);
+
+static void
+profile_alloc(void *allocation, uintptr_t site);
+
+static uintptr_t
+profile_free(void *allocation);
 
 static inline uintptr_t
 heap_pos(uint32_t *pos);
 
+static void*
+heap_realloc(void *allocation, size_t size);
+
 void init_heap(size_t heap_size)
 {
 	PrintK("Initializing heap.\n");
@@ -76,6 +112,18 @@ void map_heap(uint64_t *page_table_root)
 
 
 void *kalloc(size_t size)
+{
+    uint64_t rflags = spin_lock_irqsave(&HEAP_LOCK);
+    void *allocation = heap_alloc(size);
+    if(allocation) {
+        profile_alloc(allocation, (uintptr_t) __builtin_return_address(0));
+    }
+    spin_unlock_irqrestore(&HEAP_LOCK, rflags);
+    return allocation;
+}
+
+static void*
+heap_alloc(size_t size)
 {
     void *heap_ptr = HEAP_START;
     uint32_t *heap_header = (uint32_t*) heap_ptr;
@@ -103,6 +151,23 @@ void *kalloc(size_t size)
 }
 
 void *krealloc(void *allocation, size_t size)
+{
+    // Forget the old block before it is resized or moved, then re-attribute
+    // the result to the site which made the original allocation.
+    uint64_t rflags = spin_lock_irqsave(&HEAP_LOCK);
+    uintptr_t site = profile_free(allocation);
+    if(!site) {
+        site = (uintptr_t) __builtin_return_address(0);
+    }
+
+    void *new_allocation = heap_realloc(allocation, size);
+    profile_alloc(new_allocation ? new_allocation : allocation, site);
+    spin_unlock_irqrestore(&HEAP_LOCK, rflags);
+    return new_allocation;
+}
+
+static void*
+heap_realloc(void *allocation, size_t size)
 {
     // Round allocation up to even number.
     size = ((size + 1) >> 1) << 1;
@@ -144,18 +209,26 @@ void *krealloc(void *allocation, size_t size)
     }
 
     // Otherwise, we just need to find a new block and copy the memory.
-    void *new_allocation = kalloc(size);
+    void *new_allocation = heap_alloc(size);
     if(!new_allocation) {
         return NULL;
     }
 
-    memmove((new_allocation + HEADER_SIZE), (allocation + HEADER_SIZE),
-            block_size);
-    kfree(allocation);
-    return (new_allocation + HEADER_SIZE);
+    memmove(new_allocation, allocation, block_size);
+    heap_free(allocation);
+    return new_allocation;
 }
 
 void kfree(void *allocation)
+{
+    uint64_t rflags = spin_lock_irqsave(&HEAP_LOCK);
+    profile_free(allocation);
+    heap_free(allocation);
+    spin_unlock_irqrestore(&HEAP_LOCK, rflags);
+}
+
+static void
+heap_free(void *allocation)
 {
     // Clear allocation bits of this block's header/footer.
     uint32_t *header = (uint32_t*) (allocation - HEADER_SIZE);
@@ -368,23 +441,178 @@ threeway_merge(void *front, void *middle, void *back, size_t size)
     return split_block(front, size);
 }
 
-static inline void
-print_allocations()
+/**
+ * heap_get_stats, for callers which hold HEAP_LOCK.
+ */
+static void
+fill_stats(heap_stats_t *stats)
 {
+    memset(stats, 0, sizeof(heap_stats_t));
+    stats->heap_size    = HEAP_SIZE;
+    stats->live_bytes   = LIVE_BYTES;
+    stats->peak_bytes   = PEAK_BYTES;
+    stats->live_allocs  = LIVE_COUNT;
+    stats->num_sites    = NUM_SITES;
+    stats->untracked    = UNTRACKED;
+
     void *heap_ptr = HEAP_START;
-    uint32_t *heap_header = (uint32_t*) heap_ptr;
-    uint32_t *heap_footer = footer_from_header(heap_header);
-    PrintK("\nHEAP: %ld bytes total\n", HEAP_SIZE);
     while((uintptr_t) heap_ptr < (uintptr_t) HEAP_START + HEAP_SIZE) {
-        PrintK("\t0x%lx: (%d) | H (4 bytes) - %d | BODY (%d bytes) | F (0x%lx) (4 bytes) - %d |\n",
-               (uintptr_t) heap_ptr - (uintptr_t) HEAP_START,
-               (*heap_header & 1) > 0 ? 1 : 0,
-               *heap_header & SIZE_MASK,
-               *heap_header & SIZE_MASK,
-               heap_pos(heap_footer),
-               *heap_footer & SIZE_MASK);
-        heap_ptr += (*heap_header & SIZE_MASK) + HEADER_SIZE + FOOTER_SIZE;
-        heap_header = (uint32_t *) heap_ptr;
-        heap_footer = footer_from_header(heap_header);
+        uint32_t *heap_header = (uint32_t*) heap_ptr;
+        size_t block_size = *heap_header & SIZE_MASK;
+
+        if(!(*heap_header & 1)) {
+            // Bucket n holds free blocks of [2^n, 2^(n+1)) bytes.
+            int bucket = block_size ? 63 - __builtin_clzl(block_size) : 0;
+            if(bucket >= HEAP_HISTOGRAM_BUCKETS) {
+                bucket = HEAP_HISTOGRAM_BUCKETS - 1;
+            }
+            ++stats->free_histogram[bucket];
+            ++stats->free_blocks;
+            stats->free_bytes += block_size;
+            if(block_size > stats->largest_free) {
+                stats->largest_free = block_size;
+            }
+        }
+
+        heap_ptr += block_size + HEADER_SIZE + FOOTER_SIZE;
     }
+
+    if(stats->free_bytes) {
+        stats->fragmentation_pct = 100 - (stats->largest_free * 100) /
+                                          stats->free_bytes;
+    }
+}
+
+void heap_get_stats(heap_stats_t *stats)
+{
+    // The walk would step off the heap through a header being rewritten.
+    uint64_t rflags = spin_lock_irqsave(&HEAP_LOCK);
+    fill_stats(stats);
+    spin_unlock_irqrestore(&HEAP_LOCK, rflags);
+}
+
+bool heap_get_site(size_t idx, heap_site_stats_t *site)
+{
+    uint64_t rflags = spin_lock_irqsave(&HEAP_LOCK);
+    bool found = idx < NUM_SITES;
+    if(found) {
+        *site = SITES[idx];
+    }
+    spin_unlock_irqrestore(&HEAP_LOCK, rflags);
+    return found;
+}
+
+void heap_print_profile()
+{
+    // Snapshot everything under the lock, and print after dropping it, as
+    // PrintK is slow and takes locks of its own.
+    heap_stats_t stats;
+    heap_site_stats_t sites[HEAP_PROFILE_SITES];
+    uint64_t rflags = spin_lock_irqsave(&HEAP_LOCK);
+    fill_stats(&stats);
+    memmove(sites, SITES, stats.num_sites * sizeof(heap_site_stats_t));
+    spin_unlock_irqrestore(&HEAP_LOCK, rflags);
+
+    PrintK("\nHEAP: %d bytes total, %d live in %d allocs, %d peak\n",
+           (uint64_t) stats.heap_size, (uint64_t) stats.live_bytes,
+           (uint64_t) stats.live_allocs, (uint64_t) stats.peak_bytes);
+    PrintK("\t%d bytes free in %d blocks, largest %d, fragmentation %d percent\n",
+           (uint64_t) stats.free_bytes, (uint64_t) stats.free_blocks,
+           (uint64_t) stats.largest_free, (uint64_t) stats.fragmentation_pct);
+
+    PrintK("\tFree blocks by size:\n");
+    for(int i = 0; i < HEAP_HISTOGRAM_BUCKETS; ++i) {
+        if(stats.free_histogram[i]) {
+            PrintK("\t\t>= %d bytes: %d\n", (uint64_t) 1 << i,
+                   (uint64_t) stats.free_histogram[i]);
+        }
+    }
+
+    PrintK("\tCall sites (%d untracked allocs):\n", stats.untracked);
+    for(size_t i = 0; i < stats.num_sites; ++i) {
+        PrintK("\t\t0x%h: %d allocs, %d frees, %d bytes total, %d live\n",
+               sites[i].site, sites[i].allocs, sites[i].frees,
+               sites[i].total_bytes, sites[i].live_bytes);
+    }
+}
+
+static inline size_t
+live_slot(void *allocation)
+{
+    // Blocks are at least 2-byte aligned, so drop the low bit before hashing.
+    return (((uintptr_t) allocation >> 1) * 0x9E3779B97F4A7C15) >>
+           (64 - __builtin_ctz(HEAP_PROFILE_LIVE));
+}
+
+static void
+profile_alloc(void *allocation, uintptr_t site)
+{
+    uint32_t *header = (uint32_t*) (allocation - HEADER_SIZE);
+    uint32_t size = *header & SIZE_MASK;
+
+    LIVE_BYTES += size;
+    ++LIVE_COUNT;
+    if(LIVE_BYTES > PEAK_BYTES) {
+        PEAK_BYTES = LIVE_BYTES;
+    }
+
+    size_t site_idx;
+    for(site_idx = 0; site_idx < NUM_SITES; ++site_idx) {
+        if(SITES[site_idx].site == site) {
+            break;
+        }
+    }
+
+    if(site_idx == NUM_SITES) {
+        if(NUM_SITES == HEAP_PROFILE_SITES) {
+            ++UNTRACKED;
+            return;
+        }
+        SITES[NUM_SITES++].site = site;
+    }
+
+    size_t slot = live_slot(allocation);
+    for(size_t probes = 0; probes < HEAP_PROFILE_LIVE; ++probes) {
+        live_alloc_t *live = &LIVE_ALLOCS[slot];
+        if(!live->alloc || live->alloc == TOMBSTONE) {
+            live->alloc = allocation;
+            live->size  = size;
+            live->site  = site_idx;
+            ++SITES[site_idx].allocs;
+            SITES[site_idx].total_bytes += size;
+            SITES[site_idx].live_bytes  += size;
+            return;
+        }
+        slot = (slot + 1) % HEAP_PROFILE_LIVE;
+    }
+
+    ++UNTRACKED;
+}
+
+static uintptr_t
+profile_free(void *allocation)
+{
+    uint32_t *header = (uint32_t*) (allocation - HEADER_SIZE);
+    LIVE_BYTES -= *header & SIZE_MASK;
+    --LIVE_COUNT;
+
+    size_t slot = live_slot(allocation);
+    for(size_t probes = 0; probes < HEAP_PROFILE_LIVE; ++probes) {
+        live_alloc_t *live = &LIVE_ALLOCS[slot];
+        if(!live->alloc) {
+            break;
+        }
+
+        if(live->alloc == allocation) {
+            heap_site_stats_t *site = &SITES[live->site];
+            ++site->frees;
+            site->live_bytes -= live->size;
+            live->alloc = TOMBSTONE;
+            return site->site;
+        }
+        slot = (slot + 1) % HEAP_PROFILE_LIVE;
+    }
+
+    // Allocation was made while a profiler table was full.
+    return 0;
 }
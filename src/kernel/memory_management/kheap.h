@@ -1,10 +1,48 @@
 #ifndef KHEAP_H
 #define KHEAP_H
 
-#define SIZE_MASK	0xFFFE
+#define SIZE_MASK	0xFFFFFFFE
+
+// Free blocks are bucketed by the log2 of their size; the final bucket also
+// holds everything larger than 2^(HEAP_HISTOGRAM_BUCKETS - 1) bytes.
+#define HEAP_HISTOGRAM_BUCKETS	17
+// Maximum number of distinct kalloc call sites the profiler tracks.
+#define HEAP_PROFILE_SITES		64
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+
+// Allocation counters for a single call site of kalloc/krealloc.
+typedef struct {
+	// Return address of the caller which requested the memory.
+	uintptr_t	site;
+	uint64_t	allocs;
+	uint64_t	frees;
+	// Bytes requested over the lifetime of the heap, and bytes still held.
+	uint64_t	total_bytes;
+	uint64_t	live_bytes;
+} heap_site_stats_t;
+
+// Snapshot of heap usage, as filled by heap_get_stats.
+typedef struct {
+	size_t		heap_size;
+	size_t		live_bytes;
+	size_t		peak_bytes;
+	size_t		live_allocs;
+	size_t		free_bytes;
+	size_t		free_blocks;
+	size_t		largest_free;
+	// External fragmentation as a percentage, i.e. the share of free memory
+	// which is not part of the largest free block. 0 means all free memory
+	// is contiguous.
+	uint32_t	fragmentation_pct;
+	uint32_t	free_histogram[HEAP_HISTOGRAM_BUCKETS];
+	size_t		num_sites;
+	// Allocations which could not be attributed to a call site because one
+	// of the profiler's tables was full.
+	uint64_t	untracked;
+} heap_stats_t;
 
 void init_heap(size_t heap_size);
 void *krealloc(void *allocation, size_t size);
@@ -12,4 +50,23 @@ void *kalloc(size_t size);
 void kfree(void *allocation);
 void map_heap(uint64_t *page_table_root);
 
+/**
+ * Walk the heap and fill stats with current usage, peak usage, the free-block
+ * histogram and the fragmentation metric.
+ * @input stats The struct to fill.
+ */
+void heap_get_stats(heap_stats_t *stats);
+
+/**
+ * @input idx Index of a call site, in [0, heap_stats_t.num_sites).
+ * @output site A copy of that call site's counters.
+ * @output False if idx is out of range.
+ */
+bool heap_get_site(size_t idx, heap_site_stats_t *site);
+
+/**
+ * Print heap stats and per-call-site counters to the terminal.
+ */
+void heap_print_profile();
+
 #endif
@@ -1,9 +1,13 @@
 #include "physical_memory_manager.h"
+#include "virtual_memory_manager.h"
 #include "utils/string.h"
 #include "utils/printf.h"
+#include "utils/spin_lock.h"
 #include <stddef.h>
 
 static MemMap PHYS_MEMORY_MAP;
+// Frames are allocated and freed on every CPU, from interrupt handlers too.
+static spin_lock_t PMM_LOCK;
 
 static uint64_t UppermostUsableAddr(struct stivale2_struct_tag_memmap *memmap);
 static int FindMemEntryBySize(struct stivale2_struct_tag_memmap *memmap,
@@ -34,8 +38,10 @@ bool InitPmm(struct stivale2_struct_tag_memmap *memmap)
 		return false;
 	}
 
-	// Set all pages as used in bitmap.
-	PHYS_MEMORY_MAP.bitmap = (uint8_t*) memmap->memmap[bmp_ind].base;
+	// Set all pages as used in bitmap. It is reached through the higher half
+	// mapping of physical memory, which the bootloader's page table and all of
+	// ours have, as the entry may be anywhere in memory.
+	PHYS_MEMORY_MAP.bitmap = (uint8_t*) (memmap->memmap[bmp_ind].base + KERNEL_DATA);
 	memset(PHYS_MEMORY_MAP.bitmap, -1, PHYS_MEMORY_MAP.bitmap_size);
 
 	// Now set the usable ones as free (aside from the page containing the bmp).
@@ -65,14 +71,17 @@ bool InitPmm(struct stivale2_struct_tag_memmap *memmap)
 
 void *AllocFirstFrame() 
 {
+	uint64_t rflags = spin_lock_irqsave(&PMM_LOCK);
 	for(int i = PHYS_MEMORY_MAP.last_used + 1; i != PHYS_MEMORY_MAP.last_used; 
 			i = (i + 1) % PHYS_MEMORY_MAP.num_entries) 
 	{
 		if(! PageIsUsed(i)) {
 			SetPageUsed(i);
 			PHYS_MEMORY_MAP.last_used = i;
+			spin_unlock_irqrestore(&PMM_LOCK, rflags);
 			void *frame = (void*)((size_t) i * FRAME_SIZE);
-			memset(frame, 0, FRAME_SIZE);
+			// Zero it through the higher half, which every page table maps.
+			memset((void*) ((uintptr_t) frame + KERNEL_DATA), 0, FRAME_SIZE);
 
 			// Stivale2 spec mandates that 4GiB of memory (entries identified)
 			// as "usable" in memmap) be identity-mapped. As such, this function
@@ -81,6 +90,7 @@ void *AllocFirstFrame()
 			return frame;
 		}
 	}
+	spin_unlock_irqrestore(&PMM_LOCK, rflags);
 	return NULL;
 }
 
@@ -88,6 +98,7 @@ void *AllocContiguous(size_t size)
 {
 	uint64_t num_pages = (size / FRAME_SIZE) + (size % FRAME_SIZE > 0 ? 1 : 0);
 	
+	uint64_t rflags = spin_lock_irqsave(&PMM_LOCK);
 	for(size_t head = PHYS_MEMORY_MAP.last_used + 1; head != PHYS_MEMORY_MAP.last_used; 
 		head = (head + 1) % PHYS_MEMORY_MAP.num_entries) 
 	{
@@ -96,7 +107,7 @@ void *AllocContiguous(size_t size)
 		// Now, start from head and advance forward. If there are
 		// "num_pages" free page frames following the head page, then
 		// allocate it. If you find a used one before that, break.
-		for(tail = head; (tail - head) <= num_pages; ++tail) {
+		for(tail = head; (tail - head) < num_pages; ++tail) {
 			if(PageIsUsed(tail)) {
 				found_chunk = false;
 				head = tail;
@@ -107,23 +118,27 @@ void *AllocContiguous(size_t size)
 		// If a sufficiently large contiguous region exists,
 		// set it to 0 and break.
 		if(found_chunk) {
-			for(int i = head; i <= tail; ++i) {
+			for(int i = head; i < tail; ++i) {
 				SetPageUsed(i);
 			}
+			PHYS_MEMORY_MAP.last_used = head + num_pages;
+			spin_unlock_irqrestore(&PMM_LOCK, rflags);
 			
 			void *frame = (void*) (head * FRAME_SIZE);
-			memset(frame, 0, FRAME_SIZE * num_pages);
-			PHYS_MEMORY_MAP.last_used = head + num_pages;
+			memset((void*) ((uintptr_t) frame + KERNEL_DATA), 0, FRAME_SIZE * num_pages);
 			return frame;
 		}
 	}
+	spin_unlock_irqrestore(&PMM_LOCK, rflags);
 	return NULL;
 }
 
 void FreeFrame(void *frame)
 {
-	memset(frame, 0, FRAME_SIZE);
+	memset((void*) ((uintptr_t) frame + KERNEL_DATA), 0, FRAME_SIZE);
+	uint64_t rflags = spin_lock_irqsave(&PMM_LOCK);
 	SetPageFree(ADDR_TO_FRAME_IND((uint64_t) frame));
+	spin_unlock_irqrestore(&PMM_LOCK, rflags);
 }
 
 int NumFreeFrames()
@@ -8,6 +8,9 @@ static struct stivale2_struct_tag_kernel_base_address *BASE_ADDR;
 static struct stivale2_struct_tag_pmrs *PMRs;
 static struct stivale2_struct_tag_memmap *MMAP;
 
+static inline uint64_t *TableAt(uint64_t paddr);
+static bool MapIdentityRegions(uint64_t *page_table_root);
+static void FreeTable(uint64_t table_paddr, int level);
 static inline uint64_t *GetOrCreatePageTable(uint64_t *parent, uint64_t index, 
 											 uint16_t flags);
 static inline uint64_t *GetPageTable(uint64_t *parent, uint64_t index);
@@ -41,6 +44,17 @@ bool InitPageTable(struct stivale2_struct_tag_memmap *memmap,
 	return success;
 }
 
+void LoadKernelPageTable()
+{
+	__asm__ volatile("mov %0, %%cr3" :: 
+					 "r" ((uint64_t) KERNEL_PAGE_TABLE_ROOT) : "memory");
+}
+
+uint64_t *GetKernelPageTable()
+{
+	return KERNEL_PAGE_TABLE_ROOT;
+}
+
 bool MapKernelPmrs(uint64_t *page_table_root)
 {
 	bool success = true;
@@ -70,12 +84,6 @@ bool MapKernelPmrs(uint64_t *page_table_root)
 		uint64_t base = MMAP->memmap[i].base;
 		uint64_t bound = base + MMAP->memmap[i].length;
 
-		if(MMAP->memmap[i].type == STIVALE2_MMAP_FRAMEBUFFER ||
-			MMAP->memmap[i].type == STIVALE2_MMAP_BOOTLOADER_RECLAIMABLE) 
-		{
-			MapMultiple(page_table_root, base, bound, 0, KERNEL_PAGE & EXECUTABLE);
-		}
-
 		if(MMAP->memmap[i].type == STIVALE2_MMAP_FRAMEBUFFER) {
 			MapMultiple(page_table_root, base, bound, KERNEL_DATA, KERNEL_PAGE & EXECUTABLE);
 		}
@@ -84,18 +92,48 @@ bool MapKernelPmrs(uint64_t *page_table_root)
 		if(bound <= 0x100000000)
 			continue;	
 
-		success &= MapMultiple(page_table_root, base, bound, 0, KERNEL_PAGE);
 		success &= MapMultiple(page_table_root, base, bound, KERNEL_DATA, KERNEL_PAGE);
 	}
-
+	success &= MapIdentityRegions(page_table_root);
 
 	return success;
 }
 
+uint64_t *CreateProcessPageTable()
+{
+	uint64_t *page_table_root = AllocFirstFrame();
+	if(page_table_root == NULL)
+		return NULL;
+
+	// Every kernel mapping is in the higher half, i.e. PML4 entries 256-511,
+	// so pointing at the kernel's own PDPTs shares all of them.
+	uint64_t *kernel_pml4 = TableAt((uint64_t) KERNEL_PAGE_TABLE_ROOT);
+	uint64_t *pml4 = TableAt((uint64_t) page_table_root);
+	for(int i = 256; i < 512; ++i) {
+		pml4[i] = kernel_pml4[i];
+	}
+
+	if(!MapIdentityRegions(page_table_root)) {
+		PrintK("Failed to map identity regions of a process page table.\n");
+	}
+	return page_table_root;
+}
+
+void FreeProcessPageTable(uint64_t *page_table_root)
+{
+	// The higher half is the kernel's.
+	uint64_t *pml4 = TableAt((uint64_t) page_table_root);
+	for(int i = 0; i < 256; ++i) {
+		if(GetPageFlag(pml4[i], PRESENT))
+			FreeTable(pml4[i] & PAGE_FRAME_MASK, 3);
+	}
+	FreeFrame(page_table_root);
+}
+
 uint64_t *GetPage(uint64_t *page_table_root, uint64_t vaddr)
 {
 	
-	uint64_t *parent_table = page_table_root;
+	uint64_t *parent_table = TableAt((uint64_t) page_table_root);
 	for(int i = 4; i > 1; --i) {
 		uint64_t tab_index = V_ADDR_INDEX(vaddr, i);
 		uint64_t *child_table = GetPageTable(parent_table, tab_index);
@@ -114,11 +152,15 @@ uint64_t *GetKernelPage(uint64_t vaddr)
 uint64_t *CreatePage(uint64_t *page_table_root, uint64_t vaddr, 
 					 uint16_t flags)
 {
-	uint64_t *parent_table = page_table_root;
+	// Access is restricted by the leaf entry alone, so that read-only pages
+	// don't make their neighbours read-only too: the tables above it allow
+	// writes, and user access if any page beneath them is a user page.
+	uint16_t table_flags = PRESENT | READ_WRITABLE | (flags & USER_ACCESSIBLE);
+	uint64_t *parent_table = TableAt((uint64_t) page_table_root);
 	for(int i = 4; i > 1; --i) {
 		uint64_t tab_index = V_ADDR_INDEX(vaddr, i);
 		uint64_t *child_table = GetOrCreatePageTable(parent_table, tab_index,
-													 flags);
+													 table_flags);
 		if(child_table == NULL)
 			return NULL;
 		parent_table = child_table;
@@ -196,7 +238,7 @@ bool RemapKernelPage(uint64_t former_vaddr, uint64_t new_vaddr, uint16_t flags)
 
 uint64_t VAddrToPAddr(uint64_t *table, uint64_t vaddr)
 {
-	uint64_t *parent_table = table, *child_table;
+	uint64_t *parent_table = TableAt((uint64_t) table), *child_table;
 	for(int i = 4; i > 1; --i) {
 		uint64_t tab_index = V_ADDR_INDEX(vaddr, i);
 		child_table = GetPageTable(parent_table, tab_index);
@@ -254,6 +296,64 @@ void PrintKernelPageAttrs(uint64_t virt_addr)
 	PrintPageAttrs(KERNEL_PAGE_TABLE_ROOT, virt_addr);
 }
 
+/**
+ * Identity map what the kernel still reaches through identity mapped pointers
+ * in every page table: bootloader data (e.g. the stivale2 terminal) and the
+ * framebuffer. None of it belongs to the page table. All other memory,
+ * including that above 4GiB, is reached through the higher half mapping (see
+ * MapKernelPmrs), which processes share rather than copy.
+ * @input page_table_root The PML4 to map into.
+ * @output True if all mappings succeeded, false otherwise.
+ */
+static bool MapIdentityRegions(uint64_t *page_table_root)
+{
+	bool success = true;
+	for(uint32_t i = 0; i < MMAP->entries; ++i) {
+		uint64_t base = MMAP->memmap[i].base;
+		uint64_t bound = base + MMAP->memmap[i].length;
+
+		if(MMAP->memmap[i].type == STIVALE2_MMAP_FRAMEBUFFER ||
+			MMAP->memmap[i].type == STIVALE2_MMAP_BOOTLOADER_RECLAIMABLE) 
+		{
+			success &= MapMultiple(page_table_root, base, bound, 0,
+								   (KERNEL_PAGE | SHARED_FRAME) & EXECUTABLE);
+		}
+	}
+	return success;
+}
+
+/**
+ * Free a page table, every table below it, and every frame they map which they
+ * own, i.e. which is not a SHARED_FRAME.
+ * @input table_paddr The physical address of the table.
+ * @input level The table's level, 1 for a table of pages.
+ */
+static void FreeTable(uint64_t table_paddr, int level)
+{
+	uint64_t *table = TableAt(table_paddr);
+	for(int i = 0; i <= MAX_PAGE_IND; ++i) {
+		if(!GetPageFlag(table[i], PRESENT))
+			continue;
+		if(level > 1)
+			FreeTable(table[i] & PAGE_FRAME_MASK, level - 1);
+		else if(!GetPageFlag(table[i], SHARED_FRAME))
+			FreeFrame((void*) (table[i] & PAGE_FRAME_MASK));
+	}
+	FreeFrame((void*) table_paddr);
+}
+
+/**
+ * Page tables are reached through the higher half mapping of physical memory,
+ * which every page table has (see MapKernelPmrs), so that they can be edited
+ * whichever one is loaded.
+ * @input paddr The physical address of a page table.
+ * @output A pointer to the page table.
+ */
+static inline uint64_t *TableAt(uint64_t paddr)
+{
+	return (uint64_t*) (paddr + KERNEL_DATA);
+}
+
 /**
  * Look up the index-th entry of nth-level page table parent. If this entry has 
  * been set, return the pointer to the corresponding (n+1)th level page table.
@@ -262,14 +362,21 @@ void PrintKernelPageAttrs(uint64_t virt_addr)
  * @input parent The parent of the page table to create/retrieve.
  * @input index The index of the page table to lookup.
  * @input flags The flags to be set for this page table if it must be created.
+ * 				Its USER_ACCESSIBLE and READ_WRITABLE bits are added to an
+ * 				existing entry.
  * @output A pointer to the page table if PMM allocation succeeded, NULL 
  * 		   otherwise.
  */
 static inline uint64_t *GetOrCreatePageTable(uint64_t *parent, uint64_t index, 
 											 uint16_t flags)
 {
-	if(GetPageFlag(parent[index], PRESENT))
-		return (uint64_t*) (parent[index] & ~(511));
+	if(GetPageFlag(parent[index], PRESENT)) {
+		// The table may have been made for kernel mappings, e.g. by
+		// MapIdentityRegions, and the CPU ANDs the U/S and R/W bits of every
+		// level, so widen it to allow whatever the new mapping needs.
+		parent[index] |= flags & (USER_ACCESSIBLE | READ_WRITABLE);
+		return TableAt(parent[index] & PAGE_FRAME_MASK);
+	}
 	
 	void *free_frame = AllocFirstFrame();	
 	if(free_frame == NULL) {
@@ -277,7 +384,7 @@ static inline uint64_t *GetOrCreatePageTable(uint64_t *parent, uint64_t index,
 	}
 
 	parent[index] = ((uint64_t) free_frame) | flags;
-	return free_frame;
+	return TableAt((uint64_t) free_frame);
 }
 
 /**
@@ -290,7 +397,7 @@ static inline uint64_t *GetOrCreatePageTable(uint64_t *parent, uint64_t index,
 static inline uint64_t *GetPageTable(uint64_t *parent, uint64_t index)
 {
 	if(GetPageFlag(parent[index], PRESENT))
-		return (uint64_t*) (parent[index] & ~(511));
+		return TableAt(parent[index] & PAGE_FRAME_MASK);
 	return NULL;
 }
 
@@ -323,7 +430,7 @@ static bool AssertKernelMapping(uint64_t phys_addr, uint64_t virt_addr)
 	uint64_t *pml3, *pml2, *pml1;
 	
 	// If any entry in the desired path is not marked present, return false.
-	if(! (pml3 = GetPageTable(KERNEL_PAGE_TABLE_ROOT, pml4_entry)))
+	if(! (pml3 = GetPageTable(TableAt((uint64_t) KERNEL_PAGE_TABLE_ROOT), pml4_entry)))
 		return false;
 		
 	if(! (pml2 = GetPageTable(pml3, pml3_entry)))
@@ -21,11 +21,18 @@
 #define DIRTY						(1 << 6)	
 #define PAGE_ATTRIBUTE_TABLE		(1 << 7)	
 #define GLOBAL						(1 << 8)	
+// Software-defined (bit 9 is ignored by the MMU): the frame is not owned by
+// this page table, e.g. it belongs to the initrd or to a ring shared with the
+// kernel (see proc/uring.h), so must not be freed through it.
+#define SHARED_FRAME				(1 << 9)
 #define EXECUTABLE					(~(1UL << 62))
 
 #define KERNEL_PAGE					(PRESENT | READ_WRITABLE)
 #define USER_PAGE					(PRESENT | READ_WRITABLE | USER_ACCESSIBLE)
 
+// The physical address bits of a page table entry.
+#define PAGE_FRAME_MASK				0x000FFFFFFFFFF000
+
 // 512 entries per table, of 4KiB pages each.
 #define LOG2_ENTRIES_PER_TABLE		9
 #define LOG2_FRAME_SIZE				12
@@ -63,8 +70,38 @@ bool InitPageTable(struct stivale2_struct_tag_memmap *memmap,
 				   struct stivale2_struct_tag_kernel_base_address *kern_base_addr,
 				   struct stivale2_struct_tag_pmrs *pmrs);
 
+/**
+ * Switch the calling CPU to the kernel page table built by InitPageTable. APs
+ * start out on the bootloader's.
+ */
+void LoadKernelPageTable();
+
+/**
+ * @output The root of the kernel page table, which is identity mapped, so also
+ *         its physical address.
+ */
+uint64_t *GetKernelPageTable();
+
 bool MapKernelPmrs(uint64_t *page_table_root);
 
+/**
+ * Create the page table of a new process. Its higher half, which holds every
+ * kernel mapping, shares the kernel page table's lower-level tables rather
+ * than copying them, so kernel mappings must not be added to PML4 entries
+ * the kernel page table didn't have when the process was created. The lower
+ * half holds just the identity mappings the kernel needs (see MapKernelPmrs).
+ * @output The PML4, identity mapped, NULL if out of memory.
+ */
+uint64_t *CreateProcessPageTable();
+
+/**
+ * Free a page table made by CreateProcessPageTable, which must not be loaded
+ * on any CPU: its lower half's tables and every frame they map, except those
+ * mapped as SHARED_FRAME, which belong to someone else.
+ * @input page_table_root The PML4.
+ */
+void FreeProcessPageTable(uint64_t *page_table_root);
+
 /**
  * Given a PML4 table and a virtual address, return a pointer to the page table
  * entry corresponding to this address.
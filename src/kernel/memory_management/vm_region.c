@@ -0,0 +1,325 @@
+#include "memory_management/vm_region.h"
+#include "memory_management/physical_memory_manager.h"
+#include "memory_management/virtual_memory_manager.h"
+#include "memory_management/kheap.h"
+#include "proc/sched.h"
+#include "utils/string.h"
+#include "utils/printf.h"
+
+static inline uintptr_t
+page_of(uintptr_t addr)
+{
+	return addr & ~((uintptr_t) FRAME_SIZE - 1);
+}
+
+static inline bool
+page_mapped(uint64_t *pagemap, uintptr_t page)
+{
+	uint64_t *pte = GetPage(pagemap, page);
+	return pte && (*pte & PRESENT);
+}
+
+bool
+vm_region_add(process_t *proc, uintptr_t start, size_t mem_size, uint8_t *data,
+			  size_t file_size, uint16_t flags, uint64_t *shared_frames)
+{
+	vm_region_t *region = kalloc(sizeof(vm_region_t));
+	if(!region) {
+		return false;
+	}
+	region->start		= start;
+	region->end			= start + mem_size;
+	region->file_end	= start + file_size;
+	region->data		= data;
+	region->flags		= flags;
+	region->shareable	= !(flags & READ_WRITABLE) &&
+						  ((uintptr_t) data & (FRAME_SIZE - 1)) ==
+						  (start & (FRAME_SIZE - 1));
+	region->shared_frames = flags & READ_WRITABLE ? NULL : shared_frames;
+
+	vm_region_t **link = &proc->regions;
+	while(*link && (*link)->start < start) {
+		link = &(*link)->next;
+	}
+	region->next	= *link;
+	*link			= region;
+	return true;
+}
+
+bool
+vm_region_overlaps(process_t *proc, uintptr_t start, uintptr_t end)
+{
+	for(vm_region_t *region = proc->regions; region && region->start < end;
+		region = region->next)
+	{
+		// Empty regions hold no bytes to overlap.
+		if(region->end > start && region->end > region->start) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+vm_regions_free(process_t *proc)
+{
+	vm_region_t *region = proc->regions;
+	while(region) {
+		vm_region_t *next = region->next;
+		kfree(region);
+		region = next;
+	}
+	proc->regions = NULL;
+}
+
+/**
+ * Map a page of a process' regions, which must not be mapped yet.
+ * @input pagemap The process' page table.
+ * @input regions The process' regions.
+ * @input page The page.
+ * @input only_shared Only map the page if it can map the file's frame, i.e.
+ * 					  costs no memory or copying.
+ * @output True if the page is now mapped.
+ */
+static bool
+populate_page(uint64_t *pagemap, vm_region_t *regions, uintptr_t page,
+			  bool only_shared)
+{
+	// More than one region may share the page, e.g. the end of the text and
+	// the start of the data.
+	vm_region_t *first = NULL;
+	int num_regions = 0;
+	uint16_t flags = 0;
+	for(vm_region_t *region = regions;
+		region && region->start < page + FRAME_SIZE; region = region->next)
+	{
+		if(region->end > page) {
+			first = first ? first : region;
+			flags |= region->flags;
+			++num_regions;
+		}
+	}
+	if(!first) {
+		return false;
+	}
+
+	if(num_regions == 1 && first->shareable && page + FRAME_SIZE <= first->file_end) {
+		uint64_t paddr = KernelVAddrToPAddr((uintptr_t) first->data + (page - first->start));
+		return MapPage(pagemap, page, paddr & PAGE_FRAME_MASK, flags | SHARED_FRAME);
+	}
+	// Otherwise, a read-only page need only be copied once for every process
+	// sharing the region's frames.
+	uint64_t *shared = NULL;
+	if(num_regions == 1 && first->shared_frames) {
+		shared = &first->shared_frames[(page - page_of(first->start)) / FRAME_SIZE];
+		uint64_t paddr = __atomic_load_n(shared, __ATOMIC_ACQUIRE);
+		if(paddr) {
+			return MapPage(pagemap, page, paddr, flags | SHARED_FRAME);
+		}
+	}
+	if(only_shared) {
+		return false;
+	}
+
+	void *frame = AllocFirstFrame();
+	if(!frame) {
+		return false;
+	}
+	// Copy in each region's file bytes; the rest stays zeroed, as
+	// AllocFirstFrame left it.
+	uint8_t *bytes = (uint8_t*) ((uintptr_t) frame + KERNEL_DATA);
+	for(vm_region_t *region = first;
+		region && region->start < page + FRAME_SIZE; region = region->next)
+	{
+		uintptr_t start	= region->start > page ? region->start : page;
+		uintptr_t end	= page + FRAME_SIZE;
+		end = end < region->file_end ? end : region->file_end;
+		if(start < end) {
+			memmove(bytes + (start - page), region->data + (start - region->start),
+					end - start);
+		}
+	}
+
+	if(shared) {
+		uint64_t paddr = 0;
+		if(!__atomic_compare_exchange_n(shared, &paddr, (uint64_t) frame, false,
+										__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+			// Another process faulted it in first.
+			FreeFrame(frame);
+			frame = (void*) paddr;
+		}
+		return MapPage(pagemap, page, (uintptr_t) frame, flags | SHARED_FRAME);
+	}
+
+	if(!MapPage(pagemap, page, (uintptr_t) frame, flags)) {
+		FreeFrame(frame);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Resolve a fault on a page which is not mapped.
+ * @output True if the page is now mapped, false if addr is outside the
+ * 		   process' regions, the access is not allowed, or memory ran out.
+ */
+static bool
+vm_fault(process_t *proc, uintptr_t addr, bool write)
+{
+	// The higher half is the kernel's, shared by every pagemap.
+	if(addr >= USER_SPACE_END) {
+		return false;
+	}
+	// Other threads may be faulting on the same pages.
+	uint64_t rflags = spin_lock_irqsave(&proc->lock);
+	vm_region_t *region = proc->regions;
+	while(region && region->end <= addr) {
+		region = region->next;
+	}
+	if(!region || region->start > addr ||
+	   (write && !(region->flags & READ_WRITABLE)))
+	{
+		spin_unlock_irqrestore(&proc->lock, rflags);
+		return false;
+	}
+
+	uintptr_t page = page_of(addr);
+	if(page_mapped(proc->pagemap, page)) {
+		// Another thread got here first.
+		spin_unlock_irqrestore(&proc->lock, rflags);
+		return true;
+	}
+	if(!populate_page(proc->pagemap, proc->regions, page, false)) {
+		spin_unlock_irqrestore(&proc->lock, rflags);
+		return false;
+	}
+
+	// Sequential code tends to fault on its neighbours next.
+	uintptr_t block_size	= (uintptr_t) VM_FAULT_AROUND_PAGES * FRAME_SIZE;
+	uintptr_t block			= page & ~(block_size - 1);
+	for(uintptr_t other = block; other < block + block_size; other += FRAME_SIZE) {
+		if(other != page && !page_mapped(proc->pagemap, other)) {
+			populate_page(proc->pagemap, proc->regions, other, true);
+		}
+	}
+	spin_unlock_irqrestore(&proc->lock, rflags);
+	return true;
+}
+
+/**
+ * Find a byte of a process' memory through the higher-half mapping of physical
+ * memory, faulting its page in if need be, so that it can be reached whatever
+ * pagemap is loaded. Its frame stays put until the process is torn down.
+ * @input write Whether the byte is to be written.
+ * @output The byte's kernel address, NULL if the process may not access it.
+ */
+static uint8_t*
+user_byte(process_t *proc, uintptr_t addr, bool write)
+{
+	if(addr >= USER_SPACE_END) {
+		return NULL;
+	}
+	uint64_t needed = PRESENT | USER_ACCESSIBLE | (write ? READ_WRITABLE : 0);
+	for(;;) {
+		uint64_t rflags = spin_lock_irqsave(&proc->lock);
+		uint64_t *pte = GetPage(proc->pagemap, page_of(addr));
+		uint64_t entry = pte ? *pte : 0;
+		spin_unlock_irqrestore(&proc->lock, rflags);
+		if((entry & needed) == needed) {
+			return (uint8_t*) ((entry & PAGE_FRAME_MASK) + KERNEL_DATA +
+							   (addr - page_of(addr)));
+		}
+		// A page mapped without the access wanted stays that way.
+		if((entry & PRESENT) || !vm_fault(proc, addr, write)) {
+			return NULL;
+		}
+	}
+}
+
+/**
+ * Copy between a kernel buffer and a process' memory, a page at a time.
+ * @input to_user Whether to copy into the process rather than out of it.
+ * @output True on success, false if some byte is out of the process' reach.
+ */
+static bool
+copy_user(process_t *proc, uint8_t *buf, uintptr_t addr, size_t len, bool to_user)
+{
+	while(len) {
+		uint8_t *bytes = user_byte(proc, addr, to_user);
+		if(!bytes) {
+			return false;
+		}
+		size_t chunk = page_of(addr) + FRAME_SIZE - addr;
+		chunk = chunk < len ? chunk : len;
+		if(to_user) {
+			memmove(bytes, buf, chunk);
+		} else {
+			memmove(buf, bytes, chunk);
+		}
+		buf		+= chunk;
+		addr	+= chunk;
+		len		-= chunk;
+	}
+	return true;
+}
+
+bool
+vm_copy_in(process_t *proc, void *dst, uintptr_t src, size_t len)
+{
+	return copy_user(proc, dst, src, len, false);
+}
+
+bool
+vm_copy_out(process_t *proc, uintptr_t dst, const void *src, size_t len)
+{
+	return copy_user(proc, (uint8_t*) src, dst, len, true);
+}
+
+bool
+vm_copy_string_in(process_t *proc, char *dst, const char *src, size_t len)
+{
+	const uint8_t *bytes = NULL;
+	for(size_t i = 0; i < len; ++i) {
+		// Once a byte of a page is reachable, so is the rest of it.
+		uintptr_t addr = (uintptr_t) src + i;
+		if(i == 0 || (addr & (FRAME_SIZE - 1)) == 0) {
+			bytes = user_byte(proc, addr, false);
+			if(!bytes) {
+				return false;
+			}
+		} else {
+			++bytes;
+		}
+		dst[i] = *bytes;
+		if(!dst[i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+vm_fault_handler(trap_frame_t *frame, uint64_t error, uintptr_t addr)
+{
+	// The kernel may fault on a process' pages too, e.g. reading a syscall's
+	// arguments.
+	pcb_t *task = current_task();
+	if(!task->kthread && !(error & PF_PRESENT) &&
+	   vm_fault(task->proc, addr, error & PF_WRITE))
+	{
+		return;
+	}
+
+	if(!(error & PF_USER)) {
+		PrintK("Kernel page fault at 0x%h, rip 0x%h, error 0x%h.\n",
+				(uint64_t) addr, frame->rip, error);
+		for(;;) {
+			__asm__ volatile("cli; hlt");
+		}
+	}
+
+	PrintK("Task %d: page fault at 0x%h, rip 0x%h, error 0x%h.\n",
+			(uint64_t) task->tid, (uint64_t) addr, frame->rip, error);
+	exit_current_task();
+}
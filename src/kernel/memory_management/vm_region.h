@@ -0,0 +1,129 @@
+#ifndef VM_REGION_H
+#define VM_REGION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "proc/proc.h"
+
+// On a fault, the pages around the faulting one (in an aligned block of this
+// many) which can be mapped without copying are mapped too.
+#define VM_FAULT_AROUND_PAGES	16
+
+// User addresses are below this, the end of the lower half.
+#define USER_SPACE_END			0x0000800000000000
+
+// Page fault error code bits.
+#define PF_PRESENT				(1 << 0)
+#define PF_WRITE				(1 << 1)
+#define PF_USER					(1 << 2)
+
+/** A file-backed region of a process image, i.e. an ELF PT_LOAD segment, or
+ * an anonymous one, such as a thread's stack, which has no file data.
+ * Its pages are only mapped when first touched (see vm_fault_handler): those
+ * wholly backed by a read-only region's file data map the file's own frames,
+ * other read-only pages the region's shared frames if it has them, and the
+ * rest get a private frame holding the file's bytes, zero-filled past them.
+**/
+typedef struct vm_region {
+	// [start, end) is the region in memory, [start, file_end) the part of it
+	// backed by the file. Neither need be page-aligned.
+	uintptr_t start;
+	uintptr_t end;
+	uintptr_t file_end;
+	// The file's byte for start. Must stay in place while the region exists.
+	uint8_t *data;
+	// Page table flags for the region's pages.
+	uint16_t flags;
+	// Whether file pages may be mapped directly, i.e. the region is read-only
+	// and the file's pages line up with its pages.
+	bool shareable;
+	// For read-only regions, optionally, frames shared by every process
+	// mapping the same file, one per page from the one holding start, 0 until
+	// first faulted in (see proc/image_cache.h). Used for pages which can't
+	// map the file directly.
+	uint64_t *shared_frames;
+	// Next region by address.
+	struct vm_region *next;
+} vm_region_t;
+
+/**
+ * Add a region to a process, without mapping any of it. The process' lock
+ * must be held, unless none of its threads has started yet.
+ * @input proc The process.
+ * @input start The region's first address.
+ * @input mem_size The region's size in memory.
+ * @input data The file data to fill it with.
+ * @input file_size The size of the file data, at most mem_size.
+ * @input flags Page table flags for the region's pages.
+ * @input shared_frames Frames shared with other processes, or NULL, see
+ * 						vm_region_t. Ignored for writable regions.
+ * @output True on success, false if out of memory.
+ */
+bool
+vm_region_add(process_t *proc, uintptr_t start, size_t mem_size, uint8_t *data,
+			  size_t file_size, uint16_t flags, uint64_t *shared_frames);
+
+/**
+ * @input proc The process, whose lock must be held unless none of its threads
+ * 			   has started yet.
+ * @output Whether any of the process' regions overlaps [start, end).
+ */
+bool
+vm_region_overlaps(process_t *proc, uintptr_t start, uintptr_t end);
+
+/**
+ * Forget every region of a process. Their pages are freed with its page table.
+ * @input proc The process.
+ */
+void
+vm_regions_free(process_t *proc);
+
+/**
+ * Copy a string from a process' memory, checking that every page it touches
+ * is mapped or can be faulted in, so that a bad pointer from a syscall can't
+ * fault in the kernel. The memory is reached through the higher-half mapping
+ * of physical memory, so the process need not be the current one.
+ * @input proc The process.
+ * @input dst Where to copy the string to.
+ * @input src The process' string.
+ * @input len The size of dst.
+ * @output True on success, false if the string is not readable or does not fit
+ * 		   in dst, terminator included.
+ */
+bool
+vm_copy_string_in(process_t *proc, char *dst, const char *src, size_t len);
+
+/**
+ * Copy bytes from a process' memory, as vm_copy_string_in does strings.
+ * @input proc The process.
+ * @input dst Where to copy the bytes to.
+ * @input src The process' bytes.
+ * @input len How many to copy.
+ * @output True on success, false if some byte is not readable.
+ */
+bool
+vm_copy_in(process_t *proc, void *dst, uintptr_t src, size_t len);
+
+/**
+ * Copy bytes into a process' memory, faulting its pages in as needed.
+ * @input proc The process.
+ * @input dst Where in the process to copy the bytes to.
+ * @input src The bytes.
+ * @input len How many to copy.
+ * @output True on success, false if some byte is not writable.
+ */
+bool
+vm_copy_out(process_t *proc, uintptr_t dst, const void *src, size_t len);
+
+/**
+ * Handle a page fault: map the page of a process region at addr, and any
+ * neighbours which cost nothing to map. Called from the #PF stub.
+ * @input frame The registers at the fault.
+ * @input error The fault's error code.
+ * @input addr The faulting address, i.e. CR2.
+ */
+void
+vm_fault_handler(trap_frame_t *frame, uint64_t error, uintptr_t addr);
+
+#endif
@@ -3,11 +3,17 @@
 #include "memory_management/physical_memory_manager.h"
 #include "memory_management/virtual_memory_manager.h"
 #include "memory_management/kheap.h"
+#include "memory_management/vm_region.h"
+#include "proc/image_cache.h"
+#include "proc/thread.h"
+#include "proc/vdso.h"
+#include "proc/uring.h"
 #include "utils/string.h"
 #include "stivale2.h"
 
 static const char ELF_MAGIC[4] = { 0x7F, 'E', 'L', 'F' };
 static const uint16_t USER_PROC_PAGE = PRESENT | READ_WRITABLE | USER_ACCESSIBLE;
+static const uint16_t USER_READ_ONLY_PAGE = PRESENT | USER_ACCESSIBLE;
 
 static inline uint8_t*
 find_shdr_strtab(uint8_t *raw_elf, uint16_t num_shdrs, elf_shdr_t *shdrs)
@@ -20,65 +26,152 @@ find_shdr_strtab(uint8_t *raw_elf, uint16_t num_shdrs, elf_shdr_t *shdrs)
 	return NULL;
 }
 
-int
-parse_elf(uint8_t *raw_elf, pcb_t *pcb)
+/**
+ * @output Whether a segment's file bytes lie within the file.
+ */
+static inline bool
+in_file(image_t *image, elf_phdr_t *phdr)
 {
-	pcb->pagemap = AllocFirstFrame();
+	return phdr->offset <= image->elf_size &&
+		   phdr->file_size <= image->elf_size - phdr->offset;
+}
 
-	elf_hdr_t *header = (elf_hdr_t*) raw_elf;
-	// Verify that header contains magic number.
-	if(strncmp(header->magic, ELF_MAGIC, 4)) {
-		PrintK("ELF magic not detected.\n");
+/**
+ * @output Whether the pages of [start, end) hold any of what the kernel lays
+ * 		   out in every process itself: the thread slots, the vDSO and the
+ * 		   rings. end must not exceed USER_SPACE_END.
+ */
+static bool
+overlaps_reserved(uintptr_t start, uintptr_t end)
+{
+	start	= start & ~((uintptr_t) FRAME_SIZE - 1);
+	end		= (end + FRAME_SIZE - 1) & ~((uintptr_t) FRAME_SIZE - 1);
+	return (start < THREAD_SLOTS_TOP && end > THREAD_SLOTS_BOTTOM) ||
+		   (start < VDSO_TEXT + FRAME_SIZE && end > VDSO_DATA) ||
+		   (start < URING_BASE + URING_AREA_SIZE && end > URING_BASE);
+}
+
+/**
+ * Record a PT_LOAD segment as a region of the process, to be faulted in on
+ * first touch.
+ * @input shared_frames See vm_region_add.
+ * @output 0 on success, -1 if the header is malformed, the segment is out of
+ * 		   place, or memory ran out.
+ */
+static int
+load_segment(image_t *image, elf_phdr_t *phdr, process_t *proc,
+			 uint64_t *shared_frames)
+{
+	uint64_t end = phdr->vaddr + phdr->mem_size;
+	if(phdr->file_size > phdr->mem_size || !in_file(image, phdr)) {
+		PrintK("ELF segment at 0x%h is malformed.\n", phdr->vaddr);
+		return -1;
+	}
+	// Segments may share a page, but not bytes.
+	if(end < phdr->vaddr || end > USER_SPACE_END ||
+	   overlaps_reserved(phdr->vaddr, end) ||
+	   vm_region_overlaps(proc, phdr->vaddr, end))
+	{
+		PrintK("ELF segment at 0x%h is out of place.\n", phdr->vaddr);
 		return -1;
 	}
 
+	uint16_t flags = phdr->flags & ELF_PF_W ? USER_PROC_PAGE : USER_READ_ONLY_PAGE;
+	if(!vm_region_add(proc, phdr->vaddr, phdr->mem_size, image->elf + phdr->offset,
+					  phdr->file_size, flags, shared_frames))
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Create a new process for a task, which becomes its first thread.
+ * @input pcb The task to set up.
+ * @input entry The executable's entry point.
+ * @output 0 on success, -1 if memory ran out. On failure, free_task cleans up
+ * 		   whatever was set up.
+ */
+static int
+init_process(pcb_t *pcb, uint64_t entry)
+{
+	memset(pcb, 0, sizeof(pcb_t));
+	pcb->slot = THREAD_NO_SLOT;
+	pcb->proc = kalloc(sizeof(process_t));
+	if(!pcb->proc) {
+		return -1;
+	}
+	memset(pcb->proc, 0, sizeof(process_t));
+	pcb->proc->threads = 1;
+
 	// The process level pagemap should still contain all relevant kernel data,
 	// which is necessary to restore kernel state after interrupts. (Also, you
-	// can't just throw out things like the GDT, IDT, etc.) Here, we create those
-	// mappings in the process-level pagemap. So, map 0x1000-4GiB to higher half,
-	// and map PMRs as specified.
+	// can't just throw out things like the GDT, IDT, etc.) The kernel's half of
+	// the pagemap is shared with the kernel page table.
+	pcb->proc->pagemap = CreateProcessPageTable();
+	if(!pcb->proc->pagemap || !vdso_map(pcb->proc->pagemap)) {
+		return -1;
+	}
 
 	// Find entry point, set RIP equal to entry point.
-	pcb->registers.rip = header->entry_pt;
+	pcb->registers.rip = entry;
+	return 0;
+}
 
-	// For each of the program segments, create relevant user level pages in the
-	// process page table.
-	elf_phdr_t *phdrs = (elf_phdr_t*) (raw_elf + header->phdr_offset);
-	for(size_t i = 0; i < header->phdr_num_entries; ++i) {
-		if(phdrs[i].type == ELF_PHDR_LOAD) {
-			uint8_t *segment = (raw_elf + phdrs[i].offset);
-			size_t seg_base = phdrs[i].vaddr;
-			size_t seg_bound = seg_base + phdrs[i].mem_size;
+/**
+ * Record a PT_TLS segment as the template of the process' TLS blocks.
+ * @output 0 on success, -1 if the header is malformed or the block too large.
+ */
+static int
+load_tls(image_t *image, elf_phdr_t *phdr, process_t *proc)
+{
+	uint64_t align = phdr->alignment ? phdr->alignment : 1;
+	if(phdr->file_size > phdr->mem_size || !in_file(image, phdr) ||
+	   (align & (align - 1)) ||
+	   !thread_tls_fits(phdr->mem_size, align))
+	{
+		PrintK("ELF TLS segment of %d bytes is malformed or too large.\n",
+				phdr->mem_size);
+		return -1;
+	}
+	proc->tls_data		= image->elf + phdr->offset;
+	proc->tls_file_size	= phdr->file_size;
+	proc->tls_mem_size	= phdr->mem_size;
+	proc->tls_align		= align;
+	return 0;
+}
 
-			// Round up bound to a power of 0x1000.
-			seg_bound = (((seg_bound + (1 << LOG2_FRAME_SIZE) - 1) >> LOG2_FRAME_SIZE) 
-							<< LOG2_FRAME_SIZE);
+bool
+elf_valid(uint8_t *raw_elf)
+{
+	elf_hdr_t *header = (elf_hdr_t*) raw_elf;
+	// Verify that header contains magic number.
+	if(strncmp(header->magic, ELF_MAGIC, 4)) {
+		PrintK("ELF magic not detected.\n");
+		return false;
+	}
+	return true;
+}
 
-			// For each page of memory in segment, copy it into a newly-allocated page frame,
-			// and map the page frame to the desired location in virtual memory.
-			for(size_t off = 0; off < seg_bound; off += 0x1000) {
-				void *frame = AllocFirstFrame();
-				memmove(frame, segment + off, 0x1000);
-				MapPage(pcb->pagemap, seg_base + off, (uintptr_t) frame, USER_PROC_PAGE);
-			}
+int
+load_image(image_t *image, pcb_t *pcb)
+{
+	if(init_process(pcb, image->entry) != 0) {
+		return -1;
+	}
+	for(uint16_t i = 0; i < image->num_segments; ++i) {
+		image_segment_t *segment = &image->segments[i];
+		if(load_segment(image, &segment->phdr, pcb->proc, segment->frames) != 0) {
+			return -1;
 		}
 	}
+	if(image->tls.type == ELF_PHDR_TLS &&
+	   load_tls(image, &image->tls, pcb->proc) != 0)
+	{
+		return -1;
+	}
 
-	// Create stack, map it, and set processor RSP/RBP equal to top of stack.
-	void *stack = AllocFirstFrame();
-	MapPage(pcb->pagemap, DEFAULT_STACK_BASE, (uintptr_t) stack, USER_PROC_PAGE);
-
-	MapKernelPmrs(pcb->pagemap);
-	map_heap(pcb->pagemap);
-
-	pcb->registers.rbp = DEFAULT_STACK_BASE /*0xE0000000 + 0xFFF*/;
-	pcb->registers.rsp = DEFAULT_STACK_BASE /*0xE0000000 + 0xFFF*/;
-
-	// As of now, we are not attempting to parse section headers. However, this will
-	// become relevant when we attempt to make a dynamic linker.
-	//elf_shdr_t *shdrs = (elf_shdr_t*) (raw_elf + header->shdr_offset);
-	//uint8_t *shstrtab = find_shdr_strtab(raw_elf, header->shdr_num_entries, shdrs);
-
-	return 0;
+	image_hold(image);
+	pcb->proc->image = image;
+	return thread_init_user(pcb);
 }
-
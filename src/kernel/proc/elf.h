@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include "proc/proc.h"
 
 /* 64-bit ELF header. We don't care about 32-bit equivalent. */
@@ -126,6 +127,13 @@ typedef enum {
 	ELF_PHDR_HIPRO			=	0x7FFFFFFF
 } elf_phdr_seg_t;
 
+/* Program header flags: the permissions of the segment. */
+typedef enum {
+	ELF_PF_X				=	0x1,
+	ELF_PF_W				=	0x2,
+	ELF_PF_R				=	0x4
+} elf_phdr_flags_t;
+
 /* 64-bit ELF section header. */
 typedef struct {
 	/* There is one particular section called ".shstrtab" which serves
@@ -189,7 +197,27 @@ typedef enum {
 	ELF_SHF_EXCLUDE			=	0x8000000
 } shdr_flags_t;
 
+struct image;
+
+/**
+ * @input raw_elf An ELF file.
+ * @output Whether it has a valid ELF header.
+ */
+bool
+elf_valid(uint8_t *raw_elf);
+
+/**
+ * Build a process from a cached executable image (see proc/image_cache.h).
+ * Segments are only recorded here, and faulted in from the image's file on
+ * first touch, read-only ones mapping the file's frames where its layout
+ * allows it, or else frames shared with every other process running the
+ * image. Takes a reference to the image for the process.
+ * @input image The image.
+ * @input pcb The task to set up as the first thread of a new process.
+ * @output 0 on success, -1 if the executable is malformed or memory ran out,
+ * 		   in which case free_task frees what was set up.
+ */
 int
-parse_elf(uint8_t *raw_elf, pcb_t *pcb);
+load_image(struct image *image, pcb_t *pcb);
 
 #endif
@@ -0,0 +1,178 @@
+#include "proc/image_cache.h"
+#include "memory_management/physical_memory_manager.h"
+#include "memory_management/kheap.h"
+#include "memory_management/vm_region.h"
+#include "vfs/ustar.h"
+#include "utils/spin_lock.h"
+#include "utils/string.h"
+#include "utils/printf.h"
+
+static image_t *IMAGE_CACHE;
+static spin_lock_t IMAGE_CACHE_LOCK;
+
+// Pages spanned by a segment.
+static inline size_t
+segment_pages(elf_phdr_t *phdr)
+{
+	return ((phdr->vaddr & (FRAME_SIZE - 1)) + phdr->mem_size + FRAME_SIZE - 1) /
+		   FRAME_SIZE;
+}
+
+static void
+free_image(image_t *image)
+{
+	for(uint16_t i = 0; i < image->num_segments; ++i) {
+		uint64_t *frames = image->segments[i].frames;
+		if(!frames) {
+			continue;
+		}
+		size_t num_pages = segment_pages(&image->segments[i].phdr);
+		for(size_t page = 0; page < num_pages; ++page) {
+			if(frames[page]) {
+				FreeFrame((void*) frames[page]);
+			}
+		}
+		kfree(frames);
+	}
+	kfree(image->segments);
+	kfree(image);
+}
+
+/**
+ * Parse an executable's program headers into a new image.
+ * @output The image, with no references, NULL on failure.
+ */
+static image_t*
+read_image(void *ustar, const char *const filename)
+{
+	size_t len;
+	uint8_t *elf = (uint8_t*) ustar_find(ustar, filename, &len);
+	if(!elf || len < sizeof(elf_hdr_t) || !elf_valid(elf)) {
+		return NULL;
+	}
+
+	elf_hdr_t *header	= (elf_hdr_t*) elf;
+	size_t phdrs_size	= (size_t) header->phdr_num_entries * sizeof(elf_phdr_t);
+	if(header->phdr_offset > len || phdrs_size > len - header->phdr_offset) {
+		PrintK("ELF program headers of %s are past the end of the file.\n", filename);
+		return NULL;
+	}
+	// The entry point is iretq'd to, which faults in ring 0 if it is not
+	// canonical.
+	if(header->entry_pt >= USER_SPACE_END) {
+		PrintK("ELF entry point of %s is not a user address.\n", filename);
+		return NULL;
+	}
+	elf_phdr_t *phdrs	= (elf_phdr_t*) (elf + header->phdr_offset);
+	uint16_t num_segments = 0;
+	for(uint16_t i = 0; i < header->phdr_num_entries; ++i) {
+		num_segments += phdrs[i].type == ELF_PHDR_LOAD;
+	}
+
+	image_t *image = kalloc(sizeof(image_t));
+	if(!image) {
+		return NULL;
+	}
+	memset(image, 0, sizeof(image_t));
+	image->segments = kalloc(num_segments * sizeof(image_segment_t));
+	if(!image->segments) {
+		kfree(image);
+		return NULL;
+	}
+	memset(image->segments, 0, num_segments * sizeof(image_segment_t));
+	image->ustar		= ustar;
+	image->elf			= elf;
+	image->elf_size		= len;
+	image->entry		= header->entry_pt;
+	image->num_segments	= num_segments;
+	strncpy(image->name, filename, IMAGE_NAME_LEN);
+
+	image_segment_t *segment = image->segments;
+	for(uint16_t i = 0; i < header->phdr_num_entries; ++i) {
+		if(phdrs[i].type == ELF_PHDR_TLS) {
+			image->tls = phdrs[i];
+		}
+		if(phdrs[i].type != ELF_PHDR_LOAD) {
+			continue;
+		}
+		segment->phdr = phdrs[i];
+		if(!(phdrs[i].flags & ELF_PF_W)) {
+			size_t num_pages = segment_pages(&phdrs[i]);
+			segment->frames = kalloc(num_pages * sizeof(uint64_t));
+			if(!segment->frames) {
+				free_image(image);
+				return NULL;
+			}
+			memset(segment->frames, 0, num_pages * sizeof(uint64_t));
+		}
+		++segment;
+	}
+	return image;
+}
+
+/**
+ * Evict the least recently used unreferenced images beyond
+ * IMAGE_CACHE_MAX_UNUSED. Must be called with IMAGE_CACHE_LOCK held.
+ */
+static void
+evict_unused()
+{
+	uint32_t num_unused = 0;
+	for(image_t **link = &IMAGE_CACHE; *link;) {
+		image_t *image = *link;
+		if(image->refs == 0 && ++num_unused > IMAGE_CACHE_MAX_UNUSED) {
+			*link = image->next;
+			free_image(image);
+			continue;
+		}
+		link = &image->next;
+	}
+}
+
+image_t*
+image_get(void *ustar, const char *const filename)
+{
+	uint64_t rflags = spin_lock_irqsave(&IMAGE_CACHE_LOCK);
+	for(image_t **link = &IMAGE_CACHE; *link; link = &(*link)->next) {
+		image_t *image = *link;
+		if(image->ustar == ustar &&
+		   !strncmp(image->name, filename, IMAGE_NAME_LEN))
+		{
+			// Move it to the front.
+			*link		= image->next;
+			image->next	= IMAGE_CACHE;
+			IMAGE_CACHE	= image;
+			++image->refs;
+			spin_unlock_irqrestore(&IMAGE_CACHE_LOCK, rflags);
+			return image;
+		}
+	}
+
+	image_t *image = read_image(ustar, filename);
+	if(image) {
+		image->refs	= 1;
+		image->next	= IMAGE_CACHE;
+		IMAGE_CACHE	= image;
+		evict_unused();
+	}
+	spin_unlock_irqrestore(&IMAGE_CACHE_LOCK, rflags);
+	return image;
+}
+
+void
+image_hold(image_t *image)
+{
+	uint64_t rflags = spin_lock_irqsave(&IMAGE_CACHE_LOCK);
+	++image->refs;
+	spin_unlock_irqrestore(&IMAGE_CACHE_LOCK, rflags);
+}
+
+void
+image_put(image_t *image)
+{
+	uint64_t rflags = spin_lock_irqsave(&IMAGE_CACHE_LOCK);
+	if(--image->refs == 0) {
+		evict_unused();
+	}
+	spin_unlock_irqrestore(&IMAGE_CACHE_LOCK, rflags);
+}
@@ -0,0 +1,72 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "proc/elf.h"
+
+// Images no process is running which are kept for the next launch; beyond
+// this, the least recently used are evicted.
+#define IMAGE_CACHE_MAX_UNUSED	8
+// Longest file name in a ustar archive.
+#define IMAGE_NAME_LEN			100
+
+/** Executable image cache.
+ * The first launch of an initrd executable parses its program headers into an
+ * image, which later launches reuse. Read-only pages which can't map the
+ * initrd's frames directly (see memory_management/vm_region.h) are copied
+ * once, when first faulted in by any process, into frames every process
+ * running the image then shares. Images are refcounted; those no longer
+ * referenced stay cached until evicted, which frees their frames.
+**/
+
+typedef struct {
+	elf_phdr_t phdr;
+	// The segment's shared frames, one per page from the one holding its
+	// first byte, 0 until first faulted in. NULL for writable segments.
+	uint64_t *frames;
+} image_segment_t;
+
+typedef struct image {
+	// The archive and file the image was read from, which identify it.
+	void *ustar;
+	char name[IMAGE_NAME_LEN];
+	// The file, in place in the archive.
+	uint8_t *elf;
+	size_t elf_size;
+	uint64_t entry;
+	// The PT_LOAD segments.
+	uint16_t num_segments;
+	image_segment_t *segments;
+	// The PT_TLS segment, whose type is ELF_PHDR_NULL if there is none.
+	elf_phdr_t tls;
+	// One per image_get or image_hold not yet matched by image_put.
+	uint32_t refs;
+	// Cache link, most recently used first.
+	struct image *next;
+} image_t;
+
+/**
+ * Look an executable up in the cache, reading it from the archive if it is
+ * not cached yet.
+ * @input ustar The archive, which must stay in place while the image exists.
+ * @input filename The executable's name in the archive.
+ * @output The image, with a reference for the caller, NULL if the file does
+ * 		   not exist, is not a valid executable, or memory ran out.
+ */
+image_t*
+image_get(void *ustar, const char *const filename);
+
+/**
+ * Take another reference to an image.
+ */
+void
+image_hold(image_t *image);
+
+/**
+ * Drop a reference to an image. Once no process runs it, it may be evicted.
+ */
+void
+image_put(image_t *image);
+
+#endif
@@ -0,0 +1,33 @@
+#include "proc/kthread.h"
+#include "proc/sched.h"
+#include "memory_management/kheap.h"
+#include "utils/string.h"
+
+/**
+ * First code run by every kernel thread, entered from task_entry_trampoline
+ * with fn and arg in rdi and rsi.
+ */
+static void
+kthread_main(kthread_fn_t fn, void *arg)
+{
+	fn(arg);
+	exit_current_task();
+}
+
+pcb_t*
+kthread_create(kthread_fn_t fn, void *arg)
+{
+	pcb_t *pcb = kalloc(sizeof(pcb_t));
+	if(!pcb) {
+		return NULL;
+	}
+	memset(pcb, 0, sizeof(pcb_t));
+
+	pcb->kthread		= true;
+	pcb->proc			= kernel_process();
+	pcb->state			= TASK_NEW;
+	pcb->registers.rip	= (uintptr_t) &kthread_main;
+	pcb->registers.rdi	= (uintptr_t) fn;
+	pcb->registers.rsi	= (uintptr_t) arg;
+	return pcb;
+}
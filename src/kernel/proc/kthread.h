@@ -0,0 +1,24 @@
+#ifndef KTHREAD_H
+#define KTHREAD_H
+
+#include "proc/proc.h"
+
+/** Kernel threads.
+ * Tasks which run a kernel function in ring 0, on their own kernel stack and
+ * the kernel page table, and are otherwise scheduled like any other task.
+**/
+
+typedef void (*kthread_fn_t)(void *arg);
+
+/**
+ * Create a kernel thread, without scheduling it, so that the caller can set
+ * its affinity or priority first. Pass it to schedule_task to start it. The
+ * thread exits when fn returns.
+ * @input fn The function to run.
+ * @input arg Passed to fn.
+ * @output The thread's pcb, NULL if out of memory.
+ */
+pcb_t*
+kthread_create(kthread_fn_t fn, void *arg);
+
+#endif
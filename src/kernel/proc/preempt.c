@@ -0,0 +1,113 @@
+#include "proc/preempt.h"
+#include "proc/sched.h"
+#include "proc/workqueue.h"
+#include "hal/cpu.h"
+#include "hal/percpu.h"
+#include "utils/printf.h"
+
+#ifdef PREEMPT_TRACE
+// Longest section on any CPU, so that only new records are reported.
+static uint64_t PREEMPT_TRACE_MAX;
+
+static void report_work_fn(work_t *work);
+static work_t REPORT_WORK = WORK_INIT(&report_work_fn);
+
+static void
+report_work_fn(work_t *work)
+{
+	preempt_trace_report();
+}
+
+static inline void
+trace_start(uintptr_t pc)
+{
+	percpu_write(preempt_trace.start_tsc, rdtsc());
+	percpu_write(preempt_trace.start_pc, pc);
+}
+
+static inline void
+trace_stop(uintptr_t pc)
+{
+	preempt_trace_t *trace = &this_cpu()->preempt_trace;
+	uint64_t len = rdtsc() - trace->start_tsc;
+	if(len <= trace->max_tsc) {
+		return;
+	}
+	trace->max_tsc		= len;
+	trace->max_start_pc	= trace->start_pc;
+	trace->max_end_pc	= pc;
+
+	// Printing is itself slow, so leave it to a worker, and only for new
+	// records.
+	uint64_t max = __atomic_load_n(&PREEMPT_TRACE_MAX, __ATOMIC_RELAXED);
+	while(len > max) {
+		if(__atomic_compare_exchange_n(&PREEMPT_TRACE_MAX, &max, len, false,
+									   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			if(len > us_to_tsc(PREEMPT_TRACE_REPORT_US)) {
+				queue_work(&REPORT_WORK);
+			}
+			break;
+		}
+	}
+}
+#endif
+
+void
+preempt_disable_at(uintptr_t pc)
+{
+	percpu_add(preempt_count, 1);
+#ifdef PREEMPT_TRACE
+	if(percpu_read(preempt_count) == 1) {
+		trace_start(pc);
+	}
+#endif
+}
+
+void
+preempt_enable_at(uintptr_t pc)
+{
+#ifdef PREEMPT_TRACE
+	if(percpu_read(preempt_count) == 1) {
+		trace_stop(pc);
+	}
+#endif
+	percpu_add(preempt_count, -1);
+
+	// If an interrupt asks for a reschedule after this check, its return path
+	// sees the count at 0 and does it instead.
+	if(percpu_read(preempt_count) == 0 && percpu_read(rq.need_resched) &&
+	   irqs_enabled())
+	{
+		context_switch();
+	}
+}
+
+void
+preempt_disable()
+{
+	preempt_disable_at((uintptr_t) __builtin_return_address(0));
+}
+
+void
+preempt_enable()
+{
+	preempt_enable_at((uintptr_t) __builtin_return_address(0));
+}
+
+bool
+preemptible()
+{
+	return percpu_read(preempt_count) == 0 && irqs_enabled();
+}
+
+void
+preempt_trace_report()
+{
+	for(uint32_t i = 0; i < num_cpus(); ++i) {
+		percpu_t *cpu = percpu_of(i);
+		preempt_trace_t trace = cpu->preempt_trace;
+		PrintK("CPU %d: longest non-preemptible section %d us, 0x%h to 0x%h\n",
+				(uint64_t) i, trace.max_tsc / us_to_tsc(1),
+				(uint64_t) trace.max_start_pc, (uint64_t) trace.max_end_pc);
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef PREEMPT_H
+#define PREEMPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// With PREEMPT_TRACE, non-preemptible sections longer than this which are the
+// longest seen so far are reported.
+#define PREEMPT_TRACE_REPORT_US	100
+
+/** Kernel preemption.
+ * Kernel code running with interrupts enabled may be preempted when an
+ * interrupt returns, unless this CPU's preempt count is non-zero. Spinlocks
+ * raise the count while held, so a task is never switched out while holding
+ * one; code which relies on staying on this CPU (e.g. to use its per-CPU
+ * data) can raise it directly. If a reschedule was asked for while the count
+ * was raised, it happens as soon as the count drops back to 0.
+ *
+ * The count belongs to the CPU, not the task, so must be 0 whenever a task
+ * gives up the CPU.
+**/
+
+/** Longest non-preemptible section on a CPU, see "make PREEMPT_TRACE=1". **/
+typedef struct {
+	// When the current section began, and where.
+	uint64_t start_tsc;
+	uintptr_t start_pc;
+	// The longest section so far, in TSC ticks, and where it began and ended.
+	uint64_t max_tsc;
+	uintptr_t max_start_pc;
+	uintptr_t max_end_pc;
+} preempt_trace_t;
+
+/**
+ * Raise this CPU's preempt count.
+ * @input pc Where the section begins, for the tracer.
+ */
+void
+preempt_disable_at(uintptr_t pc);
+
+/**
+ * Lower this CPU's preempt count, and reschedule if it reached 0 with a
+ * reschedule pending and interrupts enabled.
+ * @input pc Where the section ends, for the tracer.
+ */
+void
+preempt_enable_at(uintptr_t pc);
+
+void
+preempt_disable();
+
+void
+preempt_enable();
+
+/**
+ * @output Whether the calling code may be switched out by an interrupt.
+ */
+bool
+preemptible();
+
+/**
+ * Print every CPU's longest non-preemptible section. Without PREEMPT_TRACE,
+ * nothing is recorded.
+ */
+void
+preempt_trace_report();
+
+#endif
@@ -1,92 +1,132 @@
 #include "proc.h"
 #include "gdt/gdt.h"
+#include "hal/cpu.h"
+#include "memory_management/physical_memory_manager.h"
 #include "memory_management/virtual_memory_manager.h"
+#include "memory_management/vm_region.h"
+#include "memory_management/kheap.h"
+#include "proc/image_cache.h"
+#include "proc/ptable.h"
+#include "proc/thread.h"
+#include "proc/uring.h"
+#include "utils/string.h"
 
-void
-run_proc(pcb_t *pcb)
+// Callee-saved registers popped by switch_to, then its return address.
+typedef struct {
+	uint64_t	r15;
+	uint64_t	r14;
+	uint64_t	r13;
+	uint64_t	r12;
+	uint64_t	rbx;
+	uint64_t	rbp;
+	uint64_t	rip;
+} __attribute__((packed)) switch_frame_t;
+
+extern void task_entry_trampoline();
+
+bool
+init_task_context(pcb_t *pcb)
 {
-	uint64_t ds_segsel = USER_DS_SEGSEL;
-	uint64_t cs_segsel = USER_CS_SEGSEL;
-	uint64_t pt_paddr = KernelVAddrToPAddr((uintptr_t) pcb->pagemap);
-	uint64_t inst_paddr = VAddrToPAddr((uint64_t*) pcb->pagemap, pcb->registers.rip);
-	inst_paddr = VAddrToPAddr((uint64_t*) pcb->pagemap, 0xfd000000);
-	asm volatile("mov %0, %%cr3" :: "r"(pt_paddr) :);
+	// Kernel stacks are reached through the higher-half mapping of physical
+	// memory, which every process pagemap shares with the kernel's, so they
+	// stay valid across the CR3 reload in a context switch.
+	void *stack = AllocContiguous(KERNEL_STACK_SIZE);
+	if(!stack) {
+		return false;
+	}
+	pcb->kernel_stack = (uintptr_t) stack + KERNEL_DATA + KERNEL_STACK_SIZE;
+
+	// The first switch to this task returns into task_entry_trampoline, which
+	// "returns" from an interrupt into its entry point, as if it had been
+	// interrupted there.
+	trap_frame_t *frame = (trap_frame_t*) (pcb->kernel_stack - sizeof(trap_frame_t));
+	memset(frame, 0, sizeof(trap_frame_t));
+	frame->rax		= pcb->registers.rax;
+	frame->rbx		= pcb->registers.rbx;
+	frame->rcx		= pcb->registers.rcx;
+	frame->rdx		= pcb->registers.rdx;
+	frame->rdi		= pcb->registers.rdi;
+	frame->rsi		= pcb->registers.rsi;
+	frame->rbp		= pcb->registers.rbp;
+	frame->r8		= pcb->registers.r8;
+	frame->r9		= pcb->registers.r9;
+	frame->r10		= pcb->registers.r10;
+	frame->r11		= pcb->registers.r11;
+	frame->r12		= pcb->registers.r12;
+	frame->r13		= pcb->registers.r13;
+	frame->r14		= pcb->registers.r14;
+	frame->r15		= pcb->registers.r15;
+	frame->rip		= pcb->registers.rip;
+	frame->rflags	= RFLAGS_IF;
+	if(pcb->kthread) {
+		// Enter at the top of the kernel stack, aligned as if called.
+		frame->cs	= KERN_CS_SEGSEL;
+		frame->rsp	= pcb->kernel_stack - sizeof(uint64_t);
+		frame->ss	= KERN_DS_SEGSEL;
+	} else {
+		frame->cs	= USER_CS_SEGSEL;
+		frame->rsp	= pcb->registers.rsp;
+		frame->ss	= USER_DS_SEGSEL;
+	}
 
-	asm volatile(
-			/* DS */
-			"push %14\n\t"
-			/* RSP */
-			"push %15\n\t"
-			/* RFLAGS */
-			"pushfq\n\t"
-			/* CS */
-			"push %16\n\t"
-			/* RIP */
-			"push %17\n\t"
-			"push %0\n\t"
-			"push %1\n\t"
-			"push %2\n\t"
-			"push %3\n\t"
-			"push %4\n\t"
-			"push %5\n\t"
-			"push %6\n\t"
-			"push %7\n\t"
-			"push %8\n\t"
-			"push %9\n\t"
-			"push %10\n\t"
-			"push %11\n\t"
-			"push %12\n\t"
-			"push %13\n\t"
-			"pop %%rax\n\t"
-			"pop %%rbx\n\t"
-			"pop %%rcx\n\t"
-			"pop %%rdx\n\t"
-			"pop %%rdi\n\t"
-			"pop %%rsi\n\t"
-			"pop %%r8\n\t"
-			"pop %%r9\n\t"
-			"pop %%r10\n\t"
-			"pop %%r11\n\t"
-			"pop %%r12\n\t"
-			"pop %%r13\n\t"
-			"pop %%r14\n\t"
-			"pop %%r15\n\t"
-			"mov %18, %%rbp\n\t"
-			"iretq\n\t"
-		:
-		:	"g"(pcb->registers.rax),
-			"g"(pcb->registers.rbx),
-			"g"(pcb->registers.rcx),
-			"g"(pcb->registers.rdx),
-			"g"(pcb->registers.rdi),
-			"g"(pcb->registers.rsi),
-			"g"(pcb->registers.r8),
-			"g"(pcb->registers.r9),
-			"g"(pcb->registers.r10),
-			"g"(pcb->registers.r11),
-			"g"(pcb->registers.r12),
-			"g"(pcb->registers.r13),
-			"g"(pcb->registers.r14),
-			"g"(pcb->registers.r15),
-			"g"(ds_segsel),
-			"g"(pcb->registers.rsp),
-			"g"(cs_segsel),
-			"g"(pcb->registers.rip),
-			"g"(pcb->registers.rbp)
-		:	"rax",
-			"rbx",
-			"rcx",
-			"rdx",
-			"rdi",
-			"rsi",
-			"r8",
-			"r9",
-			"r10",
-			"r11",
-			"r12",
-			"r13",
-			"r14",
-			"r15"
-	);
+	switch_frame_t *switch_frame = (switch_frame_t*) frame - 1;
+	memset(switch_frame, 0, sizeof(switch_frame_t));
+	switch_frame->rip = (uintptr_t) &task_entry_trampoline;
+
+	pcb->saved_rsp	= (uintptr_t) switch_frame;
+	// Process pagemaps are allocated by the PMM, whose frames are identity
+	// mapped, so the pointer is also the physical address.
+	pcb->cr3		= (uintptr_t) pcb->proc->pagemap;
+	return true;
+}
+
+process_t*
+kernel_process()
+{
+	static process_t KERNEL_PROCESS;
+	KERNEL_PROCESS.pagemap = GetKernelPageTable();
+	return &KERNEL_PROCESS;
 }
 
+static void
+free_process(process_t *proc)
+{
+	// First, as the ring's poller may be spawning children.
+	if(proc->uring) {
+		uring_release(proc);
+	}
+	ptable_unlink(proc);
+	if(proc->pagemap) {
+		FreeProcessPageTable(proc->pagemap);
+	}
+	vm_regions_free(proc);
+	// Only now that no page maps its frames may the image be evicted.
+	if(proc->image) {
+		image_put(proc->image);
+	}
+	kfree(proc);
+}
+
+void
+free_task(pcb_t *pcb)
+{
+	if(pcb->kernel_stack) {
+		uintptr_t stack = pcb->kernel_stack - KERNEL_STACK_SIZE - KERNEL_DATA;
+		for(uintptr_t frame = stack; frame < stack + KERNEL_STACK_SIZE; frame += FRAME_SIZE) {
+			FreeFrame((void*) frame);
+		}
+	}
+
+	// Kernel threads run in the kernel process, which is never freed.
+	process_t *proc = pcb->kthread ? NULL : pcb->proc;
+	if(pcb->tid) {
+		ptable_remove(pcb);
+	}
+	if(proc) {
+		thread_release_slot(pcb);
+	}
+	kfree(pcb);
+	if(proc && __atomic_sub_fetch(&proc->threads, 1, __ATOMIC_ACQ_REL) == 0) {
+		free_process(proc);
+	}
+}
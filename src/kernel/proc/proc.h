@@ -3,13 +3,105 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
+#include "hal/topology.h"
+#include "utils/spin_lock.h"
 
-#define DEFAULT_STACK_BASE 0xFFFFFFFF
+// Size of the kernel stack each task runs on while in the kernel.
+#define KERNEL_STACK_SIZE	0x4000
+// Most threads a process can have at once (see proc/thread.h).
+#define THREAD_SLOTS		256
+#define THREAD_NO_SLOT		(-1)
 
+/** Register state saved on a task's kernel stack on entry to the kernel.
+ * The general purpose registers are in the order left on the stack by the
+ * PUSHALL macro in idt_asm.asm, followed by the frame pushed by the CPU.
+**/
 typedef struct {
+	uint64_t	r15;
+	uint64_t	r14;
+	uint64_t	r13;
+	uint64_t	r12;
+	uint64_t	r11;
+	uint64_t	r10;
+	uint64_t	r9;
+	uint64_t	r8;
+	uint64_t	rbp;
+	uint64_t	rsi;
+	uint64_t	rdi;
+	uint64_t	rdx;
+	uint64_t	rcx;
+	uint64_t	rbx;
+	uint64_t	rax;
+	uint64_t	rip;
+	uint64_t	cs;
+	uint64_t	rflags;
+	uint64_t	rsp;
+	uint64_t	ss;
+} __attribute__((packed)) trap_frame_t;
+
+typedef enum {
+	// Loaded, but never handed to the scheduler.
+	TASK_NEW,
+	// Waiting on a run queue.
+	TASK_RUNNABLE,
+	TASK_RUNNING,
+	// Taken off the run queues by unschedule_task.
+	TASK_BLOCKED,
+	TASK_DEAD
+} task_state_t;
+
+/** A process: an address space, shared by one or more threads (pcb_t), each
+ * scheduled on its own. It lives until its last thread is reaped.
+**/
+typedef struct process {
 	uint64_t *pagemap;
+	// File-backed regions of the process image and the threads' stacks,
+	// faulted in on first touch (see memory_management/vm_region.h).
+	struct vm_region *regions;
+	// Serializes changes to pagemap and regions between the threads.
+	spin_lock_t lock;
+	// The cached executable image the process runs, if any, referenced until
+	// the process is torn down (see proc/image_cache.h).
+	struct image *image;
+	// The first thread's ID, kept until the process is torn down.
 	uint32_t pid;
 	uint32_t ppid;
+	// Process tree, kept by the process table (see proc/ptable.h): the parent,
+	// NULL once it has been reaped, and the list of children.
+	struct process *parent;
+	struct process *first_child;
+	struct process *prev_sibling;
+	struct process *next_sibling;
+	// Threads not reaped yet.
+	uint32_t threads;
+	// Thread slots, each holding a thread's user stack and TLS block (see
+	// proc/thread.h): a set bit is a slot in use, and those below
+	// slots_created have their stack region.
+	uint64_t slots[THREAD_SLOTS / 64];
+	uint32_t slots_created;
+	// The PT_TLS data every thread's TLS block starts as, then zeroes up to
+	// tls_mem_size, aligned to tls_align.
+	uint8_t *tls_data;
+	size_t tls_file_size;
+	size_t tls_mem_size;
+	size_t tls_align;
+	// Submission and completion rings, if set up (see proc/uring.h).
+	struct uring *uring;
+} process_t;
+
+/** A thread, i.e. a schedulable task. Kernel threads and idle tasks belong to
+ * no process but the kernel's (see kernel_process).
+**/
+typedef struct pcb {
+	struct process *proc;
+	// Thread ID, from the same space as PIDs; the first thread's is its
+	// process' PID. 0 for kernel threads.
+	uint32_t tid;
+	// The thread's slot in its process, THREAD_NO_SLOT if it has none.
+	int32_t slot;
+	// The thread pointer, loaded into FS.base while the thread runs.
+	uint64_t fs_base;
 	struct {
 		uint64_t	rax;
 		uint64_t	rbx;
@@ -29,9 +121,76 @@ typedef struct {
 		uint64_t	r15;
 		uint64_t	rip;
 	} registers;
+
+	// Set for kernel threads (see proc/kthread.h), which run in ring 0 on the
+	// kernel page table and never enter user mode.
+	bool kthread;
+
+	// Scheduler state, see proc/sched.c.
+	// Physical address of the process' pagemap, loaded into CR3 when switching
+	// to this task.
+	uint64_t cr3;
+	// Top of this task's kernel stack, loaded into TSS.RSP0 while it runs.
+	uintptr_t kernel_stack;
+	// Kernel stack pointer saved by switch_to while the task isn't running.
+	uintptr_t saved_rsp;
+	volatile task_state_t state;
+	// The CPU on whose run queue this task is or was last queued.
+	uint32_t cpu;
+	// CPUs the task may run on; CPU_MASK_NONE means any.
+	cpu_mask_t affinity;
+	// Set while some CPU is still executing on this task's kernel stack.
+	volatile bool on_cpu;
+	// TSC value when the task last stopped running.
+	uint64_t last_ran;
+	// Offset from SCHED_DEFAULT_PRIO; lower runs first and for longer.
+	int8_t nice;
+	// The priority the task was last queued at.
+	uint8_t prio;
+	// TSC value when the task was last switched to.
+	uint64_t slice_start;
+	// TSC ticks left of the task's current slice.
+	uint64_t slice_left;
+	// Total TSC ticks spent running.
+	uint64_t runtime;
+	// TSC value when schedule_task last queued the task, 0 once it has run.
+	uint64_t wakeup_tsc;
+	// Times the task has moved between CPUs.
+	uint32_t migrations;
+	// XSAVE/FXSAVE area (see hal/fpu.h), NULL until the task first uses the
+	// FPU or SSE.
+	void *fpu_state;
+	// The CPU whose registers were last loaded with fpu_state.
+	uint32_t fpu_cpu;
+	// Run queue link.
+	struct pcb *next;
 } pcb_t;
 
+/**
+ * Allocate a task's kernel stack and lay it out so that the first switch_to
+ * into the task enters user mode with the initial registers set by load_image
+ * (see proc/elf.h), thread_create or kthread_create.
+ * @input pcb The task to initialize.
+ * @output True on success, false if no stack could be allocated.
+ */
+bool
+init_task_context(pcb_t *pcb);
+
+/**
+ * @output The process kernel threads belong to, whose pagemap is the kernel
+ * 		   page table. It is never torn down.
+ */
+process_t*
+kernel_process();
+
+/**
+ * Free everything a dead task owns: its kernel stack, thread ID and thread
+ * slot. Once a process' last thread is freed, the process goes too: its rings,
+ * the user half of its page table with every frame it owns, its regions, its
+ * image reference and its PID. The PCB itself is freed too.
+ * @input pcb The task, which must no longer be running on any CPU.
+ */
 void
-run_proc(pcb_t *pcb);
+free_task(pcb_t *pcb);
 
 #endif
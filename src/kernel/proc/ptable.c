@@ -0,0 +1,167 @@
+#include "proc/ptable.h"
+#include "memory_management/physical_memory_manager.h"
+#include "memory_management/virtual_memory_manager.h"
+#include "utils/spin_lock.h"
+
+#define PID_WORDS			(PID_MAX / 64)
+#define PID_SUMMARY_WORDS	(PID_WORDS / 64)
+// Each radix leaf is one frame of PCB pointers.
+#define PIDS_PER_LEAF		(FRAME_SIZE / sizeof(pcb_t*))
+#define PID_LEAVES_NUM		(PID_MAX / PIDS_PER_LEAF)
+
+// A set bit is a PID in use; PID 0 always is.
+static uint64_t PID_BITMAP[PID_WORDS] = { [0] = 1 };
+// A set bit is a full word of PID_BITMAP.
+static uint64_t PID_SUMMARY[PID_SUMMARY_WORDS];
+static pcb_t **PID_LEAVES[PID_LEAVES_NUM];
+static uint32_t LAST_PID;
+static spin_lock_t PTABLE_LOCK;
+
+/**
+ * @output The lowest free PID at or above from, -1 if there is none.
+ */
+static int64_t
+find_free_pid(uint32_t from)
+{
+	uint32_t word = from / 64;
+	uint64_t free = ~PID_BITMAP[word] & (~0ull << (from % 64));
+	if(free) {
+		return word * 64 + __builtin_ctzll(free);
+	}
+
+	// Otherwise, the first word after it which isn't full.
+	uint32_t next = word + 1;
+	for(uint32_t i = next / 64; i < PID_SUMMARY_WORDS; ++i) {
+		uint64_t not_full = ~PID_SUMMARY[i];
+		if(i == next / 64) {
+			not_full &= ~0ull << (next % 64);
+		}
+		if(not_full) {
+			uint32_t w = i * 64 + __builtin_ctzll(not_full);
+			return w * 64 + __builtin_ctzll(~PID_BITMAP[w]);
+		}
+	}
+	return -1;
+}
+
+static void
+free_pid(uint32_t pid)
+{
+	PID_BITMAP[pid / 64] &= ~(1ull << (pid % 64));
+	PID_SUMMARY[pid / 4096] &= ~(1ull << (pid / 64 % 64));
+}
+
+int64_t
+ptable_add(pcb_t *pcb)
+{
+	uint64_t rflags = spin_lock_irqsave(&PTABLE_LOCK);
+	int64_t pid = LAST_PID + 1 < PID_MAX ? find_free_pid(LAST_PID + 1) : -1;
+	if(pid < 0) {
+		pid = find_free_pid(1);
+	}
+	if(pid < 0) {
+		spin_unlock_irqrestore(&PTABLE_LOCK, rflags);
+		return -1;
+	}
+
+	pcb_t ***leaf = &PID_LEAVES[pid / PIDS_PER_LEAF];
+	if(!*leaf) {
+		void *frame = AllocFirstFrame();
+		if(!frame) {
+			spin_unlock_irqrestore(&PTABLE_LOCK, rflags);
+			return -1;
+		}
+		*leaf = (pcb_t**) ((uintptr_t) frame + KERNEL_DATA);
+	}
+	(*leaf)[pid % PIDS_PER_LEAF] = pcb;
+
+	PID_BITMAP[pid / 64] |= 1ull << (pid % 64);
+	if(PID_BITMAP[pid / 64] == ~0ull) {
+		PID_SUMMARY[pid / 4096] |= 1ull << (pid / 64 % 64);
+	}
+	LAST_PID = pid;
+	pcb->tid = pid;
+	spin_unlock_irqrestore(&PTABLE_LOCK, rflags);
+	return pid;
+}
+
+void
+ptable_remove(pcb_t *pcb)
+{
+	uint64_t rflags = spin_lock_irqsave(&PTABLE_LOCK);
+	uint32_t tid = pcb->tid;
+	PID_LEAVES[tid / PIDS_PER_LEAF][tid % PIDS_PER_LEAF] = NULL;
+	if(tid != pcb->proc->pid) {
+		free_pid(tid);
+	}
+	spin_unlock_irqrestore(&PTABLE_LOCK, rflags);
+}
+
+void
+ptable_link(process_t *proc, process_t *parent)
+{
+	uint64_t rflags = spin_lock_irqsave(&PTABLE_LOCK);
+	proc->ppid			= parent ? parent->pid : 0;
+	proc->parent		= parent;
+	proc->prev_sibling	= NULL;
+	proc->next_sibling	= NULL;
+	if(parent) {
+		proc->next_sibling = parent->first_child;
+		if(parent->first_child) {
+			parent->first_child->prev_sibling = proc;
+		}
+		parent->first_child = proc;
+	}
+	spin_unlock_irqrestore(&PTABLE_LOCK, rflags);
+}
+
+void
+ptable_unlink(process_t *proc)
+{
+	uint64_t rflags = spin_lock_irqsave(&PTABLE_LOCK);
+	if(proc->prev_sibling) {
+		proc->prev_sibling->next_sibling = proc->next_sibling;
+	} else if(proc->parent) {
+		proc->parent->first_child = proc->next_sibling;
+	}
+	if(proc->next_sibling) {
+		proc->next_sibling->prev_sibling = proc->prev_sibling;
+	}
+
+	for(process_t *child = proc->first_child; child;) {
+		process_t *next = child->next_sibling;
+		child->parent		= NULL;
+		child->ppid			= 0;
+		child->prev_sibling	= NULL;
+		child->next_sibling	= NULL;
+		child = next;
+	}
+	proc->first_child = NULL;
+
+	if(proc->pid) {
+		free_pid(proc->pid);
+	}
+	spin_unlock_irqrestore(&PTABLE_LOCK, rflags);
+}
+
+uint64_t
+ptable_lock()
+{
+	return spin_lock_irqsave(&PTABLE_LOCK);
+}
+
+void
+ptable_unlock(uint64_t rflags)
+{
+	spin_unlock_irqrestore(&PTABLE_LOCK, rflags);
+}
+
+pcb_t*
+ptable_find(uint32_t pid)
+{
+	if(pid == 0 || pid >= PID_MAX) {
+		return NULL;
+	}
+	pcb_t **leaf = PID_LEAVES[pid / PIDS_PER_LEAF];
+	return leaf ? leaf[pid % PIDS_PER_LEAF] : NULL;
+}
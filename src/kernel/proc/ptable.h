@@ -0,0 +1,76 @@
+#ifndef PTABLE_H
+#define PTABLE_H
+
+#include <stdint.h>
+#include "proc/proc.h"
+
+// Thread IDs and PIDs are in [1, PID_MAX); 0 is the kernel's, shared by
+// kernel threads.
+#define PID_MAX				32768
+
+/** Process table.
+ * Maps thread IDs to threads, and links each process to its parent and
+ * children. A process' PID is its first thread's ID, which stays taken until
+ * the process is torn down even if that thread exits first.
+ * Free IDs are tracked by a bitmap with a summary bitmap of its full words
+ * above it, so finding one takes a few bit scans however many processes
+ * exist. They are handed out in increasing order, wrapping around, so that an
+ * ID is not reused soon after its thread exits. The PCBs are found through
+ * a two-level radix table whose leaves, a frame of pointers each, are
+ * allocated the first time a PID in their range is used.
+ *
+ * A thread keeps its ID until it is reaped (see free_task), so a dead thread
+ * which has not been reaped yet can still be looked up.
+**/
+
+/**
+ * Give a thread an ID.
+ * @input pcb The thread.
+ * @output The ID, -1 if they have run out.
+ */
+int64_t
+ptable_add(pcb_t *pcb);
+
+/**
+ * Remove a thread from the table, freeing its ID unless it is still its
+ * process' PID.
+ * @input pcb The thread, which must have been added.
+ */
+void
+ptable_remove(pcb_t *pcb);
+
+/**
+ * Make a process a child of parent.
+ * @input proc The process, whose PID must be set.
+ * @input parent Its parent, or NULL for none (ppid 0).
+ */
+void
+ptable_link(process_t *proc, process_t *parent);
+
+/**
+ * Take a process out of the process tree, and free its PID. Its children are
+ * orphaned, i.e. left with no parent and ppid 0.
+ * @input proc The process.
+ */
+void
+ptable_unlink(process_t *proc);
+
+/**
+ * Lock the table, so that no thread is added or removed, and so none found
+ * by ptable_find is reaped, until ptable_unlock.
+ * @output The RFLAGS to pass to ptable_unlock.
+ */
+uint64_t
+ptable_lock();
+
+void
+ptable_unlock(uint64_t rflags);
+
+/**
+ * Look a thread up by ID. The table must be locked.
+ * @output The thread, NULL if there is none with that ID.
+ */
+pcb_t*
+ptable_find(uint32_t pid);
+
+#endif
@@ -1,2 +1,890 @@
 #include "proc/sched.h"
+#include "proc/sched_trace.h"
+#include "proc/workqueue.h"
+#include "hal/cpu.h"
+#include "hal/lapic.h"
+#include "hal/percpu.h"
+#include "hal/io_apic.h"
+#include "hal/fpu.h"
+#include "utils/printf.h"
 
+/** O(1) priority scheduler with one run queue per CPU.
+ * Each queue holds an active and an expired priority array (see
+ * prio_array_t), so picking the next task is a bit scan and a list pop
+ * however many tasks are queued. A task's slice is longer the higher its
+ * priority, and is charged in TSC ticks for the time it actually ran, so a
+ * task preempted or blocked early keeps the remainder for its next turn.
+ *
+ * Each task has a kernel stack of its own, on which the CPU saves its user
+ * state on interrupts (TSS.RSP0) and syscalls.
+ * schedule requeues the current task and switch_to's the next one's kernel
+ * stack, so a task is always switched out from inside the kernel, and resumes
+ * by returning from the interrupt or syscall which brought it there.
+ *
+ * Preemption is tickless: a CPU only arms its slice timer while some task is
+ * waiting for it, so an idle CPU, or one running a single task, takes no
+ * timer interrupts. Instead, whoever queues a task onto a CPU which may not
+ * be ticking sends it a reschedule IPI, or, if it is idle in mwait, just
+ * clears its polling flag.
+ *
+ * New tasks are placed on the least loaded CPU they are allowed on, and woken
+ * ones near the caches they last ran with (see select_rq). A CPU which runs
+ * out of work steals from the busiest other queue (see steal_tasks), so there
+ * is no global lock; each queue's lock is only contended by its own CPU, by
+ * CPUs scheduling onto it, and by thieves.
+**/
+
+// CPUID.1:ECX and CPUID.5:ECX feature bits.
+#define CPUID_1_ECX_MONITOR		(1 << 3)
+#define CPUID_5_ECX_EXTENSIONS	(1 << 0)
+#define CPUID_5_ECX_IRQ_BREAK	(1 << 1)
+// mwait hint for C1, and extension to wake on interrupts while they are masked.
+#define MWAIT_C1				0x00
+#define MWAIT_IRQ_BREAK			(1 << 0)
+
+static uint8_t SCHED_NUM_CPUS;
+// Whether idle CPUs wait in mwait rather than hlt.
+static bool SCHED_MWAIT;
+
+static inline uint8_t
+task_prio(pcb_t *pcb)
+{
+	int32_t prio = SCHED_DEFAULT_PRIO + pcb->nice;
+	if(prio < 0) {
+		return 0;
+	}
+	if(prio >= SCHED_NUM_PRIOS) {
+		return SCHED_NUM_PRIOS - 1;
+	}
+	return prio;
+}
+
+/**
+ * @output The length of a full slice for pcb, in TSC ticks.
+ */
+static inline uint64_t
+task_slice(pcb_t *pcb)
+{
+	return us_to_tsc(SCHED_SLICE_US * (SCHED_NUM_PRIOS - task_prio(pcb)) /
+					 (SCHED_NUM_PRIOS - SCHED_DEFAULT_PRIO));
+}
+
+static inline cpu_mask_t
+task_cpus(pcb_t *pcb)
+{
+	cpu_mask_t mask = __atomic_load_n(&pcb->affinity, __ATOMIC_RELAXED);
+	return mask ? mask : CPU_MASK_ALL;
+}
+
+static inline bool
+task_allowed(pcb_t *pcb, uint32_t cpu)
+{
+	return task_cpus(pcb) & cpu_mask_of(cpu);
+}
+
+static cpu_mask_t
+online_cpus()
+{
+	cpu_mask_t mask = CPU_MASK_NONE;
+	for(uint32_t i = 0; i < num_cpus() && i < SCHED_NUM_CPUS; ++i) {
+		if(__atomic_load_n(&percpu_of(i)->rq.online, __ATOMIC_ACQUIRE)) {
+			mask |= cpu_mask_of(i);
+		}
+	}
+	return mask;
+}
+
+/**
+ * @output The online CPUs in mask with nothing to run. Unlocked, so only a
+ *         hint.
+ */
+static cpu_mask_t
+idle_cpus(cpu_mask_t mask)
+{
+	cpu_mask_t idle = CPU_MASK_NONE;
+	uint32_t i;
+	for_each_cpu(i, mask & online_cpus()) {
+		if(percpu_of(i)->rq.nr_running == 0) {
+			idle |= cpu_mask_of(i);
+		}
+	}
+	return idle;
+}
+
+static inline bool
+rq_has_queued(run_queue_t *rq)
+{
+	return rq->active->bitmap || rq->expired->bitmap;
+}
+
+static inline void
+enqueue(prio_array_t *array, pcb_t *pcb)
+{
+	uint8_t prio = task_prio(pcb);
+	pcb->prio = prio;
+	pcb->next = NULL;
+	if(array->tail[prio]) {
+		array->tail[prio]->next = pcb;
+	} else {
+		array->head[prio] = pcb;
+		array->bitmap |= 1ull << prio;
+	}
+	array->tail[prio] = pcb;
+}
+
+/**
+ * Unlink pcb from its list in array, given the task before it (or NULL).
+ */
+static inline void
+unlink(prio_array_t *array, pcb_t *pcb, pcb_t *prev)
+{
+	uint8_t prio = pcb->prio;
+	if(prev) {
+		prev->next = pcb->next;
+	} else {
+		array->head[prio] = pcb->next;
+	}
+	if(array->tail[prio] == pcb) {
+		array->tail[prio] = prev;
+	}
+	if(!array->head[prio]) {
+		array->bitmap &= ~(1ull << prio);
+	}
+	pcb->next = NULL;
+}
+
+/**
+ * Queue a runnable task on rq: on the active array if it has some of its
+ * slice left, otherwise on the expired one with a fresh slice.
+ */
+static inline void
+enqueue_task(run_queue_t *rq, pcb_t *pcb)
+{
+	if(pcb->slice_left) {
+		enqueue(rq->active, pcb);
+	} else {
+		pcb->slice_left = task_slice(pcb);
+		enqueue(rq->expired, pcb);
+	}
+}
+
+static inline pcb_t*
+dequeue(prio_array_t *array)
+{
+	if(!array->bitmap) {
+		return NULL;
+	}
+	pcb_t *pcb = array->head[__builtin_ctzll(array->bitmap)];
+	unlink(array, pcb, NULL);
+	return pcb;
+}
+
+static bool
+remove(prio_array_t *array, pcb_t *pcb)
+{
+	pcb_t *cur = array->head[pcb->prio], *prev = NULL;
+	while(cur && cur != pcb) {
+		prev = cur;
+		cur = cur->next;
+	}
+	if(cur) {
+		unlink(array, pcb, prev);
+	}
+	return cur != NULL;
+}
+
+/**
+ * Take the next task to run off rq: the highest priority one with some of its
+ * slice left, starting a new round first if there is none.
+ */
+static pcb_t*
+pick_next(run_queue_t *rq)
+{
+	if(!rq->active->bitmap) {
+		prio_array_t *tmp	= rq->active;
+		rq->active			= rq->expired;
+		rq->expired			= tmp;
+	}
+	return dequeue(rq->active);
+}
+
+static run_queue_t*
+least_loaded_rq(cpu_mask_t mask)
+{
+	run_queue_t *best = NULL;
+	uint32_t i;
+	for_each_cpu(i, mask) {
+		run_queue_t *rq = &percpu_of(i)->rq;
+		// A stale count only costs balance, so don't take the lock.
+		if(!best || rq->nr_running < best->nr_running) {
+			best = rq;
+		}
+	}
+	return best;
+}
+
+/**
+ * Choose the run queue for a task being queued. A woken task goes back to its
+ * last CPU if that is idle, or else to an idle CPU sharing that CPU's last
+ * level cache, where its working set may still be. Among those, a CPU whose
+ * SMT siblings are idle too is preferred, so it need not share a core.
+ * Anything else goes to the least loaded CPU the task is allowed on.
+ */
+static run_queue_t*
+select_rq(pcb_t *pcb, bool waking)
+{
+	cpu_mask_t online	= online_cpus();
+	cpu_mask_t allowed	= task_cpus(pcb) & online;
+	if(!allowed) {
+		// Pinned only to CPUs which never came up.
+		allowed = online;
+	}
+
+	if(waking && (online & cpu_mask_of(pcb->cpu))) {
+		percpu_t *last = percpu_of(pcb->cpu);
+		if((allowed & cpu_mask_of(pcb->cpu)) && last->rq.nr_running == 0) {
+			return &last->rq;
+		}
+
+		cpu_mask_t idle			= idle_cpus(last->topo.llc_siblings);
+		cpu_mask_t candidates	= idle & allowed;
+		uint32_t i;
+		for_each_cpu(i, candidates) {
+			if(!(percpu_of(i)->topo.smt_siblings & ~idle)) {
+				return &percpu_of(i)->rq;
+			}
+		}
+		if(candidates) {
+			return &percpu_of(__builtin_ctzll(candidates))->rq;
+		}
+	}
+	return least_loaded_rq(allowed);
+}
+
+static inline bool
+task_is_cache_hot(pcb_t *pcb)
+{
+	return rdtsc() - pcb->last_ran < us_to_tsc(SCHED_MIGRATION_COST_US);
+}
+
+static run_queue_t*
+busiest_rq(run_queue_t *self, cpu_mask_t mask)
+{
+	run_queue_t *busiest = NULL;
+	uint32_t i;
+	for_each_cpu(i, mask & online_cpus()) {
+		run_queue_t *rq = &percpu_of(i)->rq;
+		// Unlocked peek, rechecked by the thief under the victim's lock.
+		// One task is the victim's current, so it needs two to spare one.
+		if(rq == self || rq->nr_running < 2) {
+			continue;
+		}
+		if(!busiest || rq->nr_running > busiest->nr_running) {
+			busiest = rq;
+		}
+	}
+	return busiest;
+}
+
+/**
+ * Move up to half of the imbalance between the busiest queue and this one
+ * onto this one, starting from the tasks which have waited longest and so are
+ * least likely to be cache-hot. Queues sharing this CPU's last level cache are
+ * tried first, as tasks taken from them keep their cached data. Called with
+ * rq->lock held.
+ * @input rq This CPU's run queue.
+ * @output The number of tasks stolen.
+ */
+static uint32_t
+steal_tasks(run_queue_t *rq)
+{
+	run_queue_t *victim = busiest_rq(rq, this_cpu()->topo.llc_siblings);
+	if(!victim) {
+		victim = busiest_rq(rq, CPU_MASK_ALL);
+	}
+	// Never wait for the victim's lock while holding our own: two CPUs
+	// stealing from each other would deadlock. Whoever holds it will likely
+	// schedule from that queue anyway.
+	if(!victim || !spin_trylock(&victim->lock)) {
+		return 0;
+	}
+
+	uint32_t to_move = 1;
+	if(victim->nr_running > rq->nr_running + 2) {
+		to_move = (victim->nr_running - rq->nr_running) / 2;
+	}
+	bool ignore_hot = rq->failed_steals >= SCHED_MAX_FAILED_STEALS;
+
+	// Tasks waiting on the active array ran longest ago.
+	uint32_t moved = 0;
+	prio_array_t *arrays[] = { victim->active, victim->expired };
+	for(uint32_t i = 0; i < 2 && moved < to_move; ++i) {
+		uint64_t bitmap = arrays[i]->bitmap;
+		while(bitmap && moved < to_move) {
+			uint8_t prio = __builtin_ctzll(bitmap);
+			bitmap &= bitmap - 1;
+
+			pcb_t *pcb = arrays[i]->head[prio], *prev = NULL;
+			while(pcb && moved < to_move) {
+				pcb_t *next = pcb->next;
+				if(!task_allowed(pcb, rq->idle.cpu) ||
+				   (!ignore_hot && task_is_cache_hot(pcb)))
+				{
+					prev = pcb;
+				} else {
+					unlink(arrays[i], pcb, prev);
+					--victim->nr_running;
+
+					++pcb->migrations;
+					sched_trace_migrate(pcb->tid, pcb->cpu, rq->idle.cpu,
+										rq->nr_running + 1);
+					pcb->cpu = rq->idle.cpu;
+					enqueue(i == 0 ? rq->active : rq->expired, pcb);
+					++rq->nr_running;
+					++moved;
+				}
+				pcb = next;
+			}
+		}
+	}
+	spin_unlock(&victim->lock);
+
+	rq->failed_steals = moved ? 0 : rq->failed_steals + 1;
+	return moved;
+}
+
+extern void switch_to(uintptr_t *prev_rsp, uintptr_t next_rsp);
+void sched_switch_done();
+
+static void reap_dead_tasks(work_t *work);
+// Dead tasks waiting to be freed, linked through next, and the work which
+// frees them: a task can't free the stack it is running on, and the CPU
+// switching away from it holds a run queue lock.
+static pcb_t *DEAD_TASKS;
+static spin_lock_t DEAD_TASKS_LOCK;
+static work_t REAP_WORK = WORK_INIT(&reap_dead_tasks);
+
+static void
+reap_dead_tasks(work_t *work)
+{
+	uint64_t rflags = spin_lock_irqsave(&DEAD_TASKS_LOCK);
+	pcb_t *dead = DEAD_TASKS;
+	DEAD_TASKS = NULL;
+	spin_unlock_irqrestore(&DEAD_TASKS_LOCK, rflags);
+
+	while(dead) {
+		pcb_t *next = dead->next;
+		free_task(dead);
+		dead = next;
+	}
+}
+
+/**
+ * Send a reschedule IPI to the CPU owning rq (which may be this one).
+ */
+static void
+resched_cpu(run_queue_t *rq)
+{
+	// An idle CPU waiting in mwait is woken by the store alone.
+	if(__atomic_exchange_n(&rq->polling, false, __ATOMIC_SEQ_CST)) {
+		__atomic_fetch_add(&rq->idle_stats.ipis_saved, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	ipi_t ipi;
+	ipi.lower_dword			= 0;
+	ipi.upper_dword			= 0;
+	ipi.vector				= RESCHED_VECTOR;
+	ipi.delivery_mode		= LVT_FIXED;
+	ipi.level				= 1;
+	ipi.destination_field	= percpu_of(rq->idle.cpu)->lapic_id;
+
+	uint64_t rflags = irq_save();
+	send_ipi(&ipi);
+	irq_restore(rflags);
+}
+
+static void
+slice_expired(void *arg)
+{
+	run_queue_t *rq = arg;
+	rq->need_resched = true;
+}
+
+/**
+ * Arm or disarm this CPU's slice timer. Called on this CPU with interrupts
+ * disabled.
+ * @input rq This CPU's run queue.
+ * @input contended Whether tasks are waiting on rq.
+ * @input new_slice Restart the slice even if the timer is armed.
+ */
+static void
+update_slice_timer(run_queue_t *rq, bool contended, bool new_slice)
+{
+	pcb_t *current = rq->current;
+	bool need_tick = contended && current != &rq->idle;
+	if(rq->slice_timer.armed && (new_slice || !need_tick)) {
+		timer_remove(&rq->slice_timer);
+	}
+	if(need_tick && !rq->slice_timer.armed) {
+		// Armed late if the task ran alone for a while, in which case that
+		// time counts against its slice and the deadline may have passed.
+		rq->slice_timer.deadline = current->slice_start + current->slice_left;
+		timer_add(&rq->slice_timer);
+	}
+}
+
+/**
+ * Ask an idle CPU, if any, to steal from this busy one, preferring one which
+ * shares its last level cache. An idle CPU takes no interrupts, so would
+ * otherwise never look.
+ */
+static void
+kick_idle_cpu(run_queue_t *busy)
+{
+	cpu_mask_t idle = idle_cpus(percpu_of(busy->idle.cpu)->topo.llc_siblings);
+	if(!idle) {
+		idle = idle_cpus(CPU_MASK_ALL);
+	}
+	if(idle) {
+		resched_cpu(&percpu_of(__builtin_ctzll(idle))->rq);
+	}
+}
+
+/**
+ * Pick the next task to run on this CPU and switch to it. Must be called with
+ * interrupts disabled. Returns once the calling task is scheduled again,
+ * possibly on another CPU.
+ */
+static void
+schedule()
+{
+	percpu_t *cpu = this_cpu();
+	run_queue_t *rq = &cpu->rq;
+
+	spin_lock(&rq->lock);
+	rq->need_resched = false;
+	uint64_t now	= rdtsc();
+	pcb_t *prev		= rq->current;
+	prev->last_ran	= now;
+	if(prev != &rq->idle) {
+		uint64_t ran		= now - prev->slice_start;
+		prev->runtime		+= ran;
+		prev->slice_left	= ran < prev->slice_left ? prev->slice_left - ran : 0;
+		if(prev->state == TASK_RUNNING && !task_allowed(prev, cpu->cpu_index)) {
+			// Its affinity changed; requeue it elsewhere once off its stack.
+			prev->state			= TASK_BLOCKED;
+			rq->migrate_prev	= true;
+			--rq->nr_running;
+		} else if(prev->state == TASK_RUNNING) {
+			prev->state = TASK_RUNNABLE;
+			enqueue_task(rq, prev);
+		} else {
+			// Blocked or dead, so no longer counted as load.
+			--rq->nr_running;
+			if(prev->state == TASK_DEAD) {
+				sched_trace_event(SCHED_EV_EXIT, prev->tid, rq->nr_running,
+								  prev->runtime);
+			}
+		}
+	}
+
+	pcb_t *next = pick_next(rq);
+	if(!next && steal_tasks(rq)) {
+		next = pick_next(rq);
+	}
+	if(!next) {
+		next = &rq->idle;
+	}
+	next->state			= TASK_RUNNING;
+	next->slice_start	= now;
+	rq->current			= next;
+	bool contended		= rq_has_queued(rq);
+	spin_unlock(&rq->lock);
+
+	update_slice_timer(rq, contended, true);
+	if(next == prev) {
+		return;
+	}
+
+	if(next->wakeup_tsc) {
+		sched_trace_wakeup_latency(next->wakeup_tsc);
+		next->wakeup_tsc = 0;
+	}
+	sched_trace_event(SCHED_EV_SWITCH, next->tid, rq->nr_running, prev->tid);
+
+	// A task blocked on another CPU and woken onto this one may not have
+	// left that CPU's stack yet.
+	while(__atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) {
+		cpu_relax();
+	}
+	next->on_cpu	= true;
+	rq->prev		= prev;
+
+	if(next != &rq->idle) {
+		cpu->tss.RSP0		= next->kernel_stack;
+		cpu->kernel_stack	= next->kernel_stack;
+	}
+	// Tasks sharing an address space (e.g. idle and any kernel task) keep the
+	// TLB warm.
+	if(next->cr3 != rq->loaded_cr3) {
+		write_cr3(next->cr3);
+		rq->loaded_cr3 = next->cr3;
+	}
+	// The kernel doesn't use FS, so it is only switched between user threads.
+	if(!next->kthread && next->fs_base != rq->loaded_fs_base) {
+		wrmsr(MSR_FS_BASE, next->fs_base);
+		rq->loaded_fs_base = next->fs_base;
+	}
+	fpu_switch(prev, next);
+
+	switch_to(&prev->saved_rsp, next->saved_rsp);
+	// We may have been resumed on another CPU, so cpu and rq are stale.
+	sched_switch_done();
+}
+
+/**
+ * Called once we are running on the next task's stack, after which the
+ * previous task may run elsewhere. New tasks call this from
+ * task_entry_trampoline.
+ */
+void
+sched_switch_done()
+{
+	run_queue_t *rq = &this_cpu()->rq;
+	pcb_t *prev = rq->prev;
+	if(prev) {
+		bool migrate		= rq->migrate_prev;
+		rq->prev			= NULL;
+		rq->migrate_prev	= false;
+		__atomic_store_n(&prev->on_cpu, false, __ATOMIC_RELEASE);
+		if(migrate) {
+			schedule_task(prev);
+		} else if(prev->state == TASK_DEAD) {
+			spin_lock(&DEAD_TASKS_LOCK);
+			prev->next	= DEAD_TASKS;
+			DEAD_TASKS	= prev;
+			spin_unlock(&DEAD_TASKS_LOCK);
+			queue_work(&REAP_WORK);
+		}
+	}
+}
+
+void
+sched_timer_handler()
+{
+	timer_interrupt();
+
+	// The slice ended; sched_irq_exit switches tasks if it can. With more
+	// than one task waiting, share them with an idle CPU.
+	run_queue_t *rq = &this_cpu()->rq;
+	if(rq->need_resched && rq->nr_running > 2) {
+		kick_idle_cpu(rq);
+	}
+}
+
+void
+sched_resched_handler()
+{
+	end_of_interrupt(false, RESCHED_VECTOR);
+
+	// The idle loop looks at the queue as soon as this returns.
+	run_queue_t *rq = &this_cpu()->rq;
+	if(rq->current == &rq->idle) {
+		return;
+	}
+
+	spin_lock(&rq->lock);
+	bool contended	= rq_has_queued(rq);
+	bool preempt	= !task_allowed(rq->current, rq->idle.cpu) ||
+					  (rq->active->bitmap &&
+					   __builtin_ctzll(rq->active->bitmap) < rq->current->prio);
+	spin_unlock(&rq->lock);
+
+	// Either a higher priority task was queued, the current one may no longer
+	// run here, or work was queued behind the
+	// current task, which now needs its slice timed.
+	if(preempt) {
+		rq->need_resched = true;
+	} else {
+		update_slice_timer(rq, contended, false);
+	}
+}
+
+void
+sched_irq_exit(trap_frame_t *frame)
+{
+	run_queue_t *rq = &this_cpu()->rq;
+	if(!rq->need_resched || rq->current == &rq->idle) {
+		return;
+	}
+
+	// Returning to user mode is always a safe point. Kernel code is only
+	// preempted if it had interrupts enabled and holds no locks.
+	bool to_user = frame->cs & 3;
+	if(!to_user && (!(frame->rflags & RFLAGS_IF) || percpu_read(preempt_count))) {
+		return;
+	}
+	schedule();
+}
+
+void
+global_init_scheduler(uint8_t num_cpus)
+{
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	if(ecx & CPUID_1_ECX_MONITOR) {
+		cpuid(5, 0, &eax, &ebx, &ecx, &edx);
+		SCHED_MWAIT = (ecx & CPUID_5_ECX_EXTENSIONS) && (ecx & CPUID_5_ECX_IRQ_BREAK);
+	}
+
+	SCHED_NUM_CPUS = num_cpus;
+	local_init_scheduler();
+}
+
+void
+local_init_scheduler()
+{
+	percpu_t *cpu = this_cpu();
+	run_queue_t *rq = &cpu->rq;
+
+	rq->idle.state		= TASK_RUNNING;
+	rq->idle.kthread	= true;
+	rq->idle.proc		= kernel_process();
+	rq->idle.cpu		= cpu->cpu_index;
+	rq->idle.on_cpu		= true;
+	rq->idle.cr3		= read_cr3();
+	rq->loaded_cr3	= rq->idle.cr3;
+	rq->current		= &rq->idle;
+	rq->active		= &rq->arrays[0];
+	rq->expired		= &rq->arrays[1];
+	rq->slice_timer.callback	= &slice_expired;
+	rq->slice_timer.arg			= rq;
+
+	timer_init();
+	__atomic_store_n(&rq->online, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * Wait for work with interrupts disabled, and account the time as idle.
+ */
+static void
+idle_wait(run_queue_t *rq)
+{
+	uint64_t start = rdtsc();
+	if(SCHED_MWAIT) {
+		// Publish polling before checking the queue: a waker either sees it
+		// and clears it, waking us through the monitor, or has already queued
+		// work we are about to see.
+		__atomic_store_n(&rq->polling, true, __ATOMIC_SEQ_CST);
+		monitor(&rq->polling);
+		if(rq->polling && rq->nr_running == 0) {
+			// Interrupts still end the wait, but are only taken once we
+			// re-enable them, so their handlers are not counted as idle.
+			mwait(MWAIT_C1, MWAIT_IRQ_BREAK);
+		}
+		__atomic_store_n(&rq->polling, false, __ATOMIC_RELAXED);
+	} else {
+		safe_halt();
+		__asm__ volatile("cli" ::: "memory");
+	}
+
+	rq->idle_stats.idle_tsc += rdtsc() - start;
+	++rq->idle_stats.entries;
+}
+
+void
+sched_idle()
+{
+	// The idle task is never queued, so never leaves this CPU.
+	run_queue_t *rq = &this_cpu()->rq;
+	for(;;) {
+		__asm__ volatile("cli" ::: "memory");
+		if(rq->nr_running == 0) {
+			idle_wait(rq);
+		}
+		// Even with nothing queued here, we may have been woken to steal.
+		schedule();
+		__asm__ volatile("sti" ::: "memory");
+	}
+}
+
+idle_stats_t
+sched_idle_stats(uint32_t cpu)
+{
+	idle_stats_t *stats = &percpu_of(cpu)->rq.idle_stats;
+	return (idle_stats_t) {
+		.idle_tsc	= __atomic_load_n(&stats->idle_tsc, __ATOMIC_RELAXED),
+		.entries	= __atomic_load_n(&stats->entries, __ATOMIC_RELAXED),
+		.ipis_saved	= __atomic_load_n(&stats->ipis_saved, __ATOMIC_RELAXED)
+	};
+}
+
+void
+schedule_task(pcb_t *pcb)
+{
+	if(pcb->state == TASK_NEW && !init_task_context(pcb)) {
+		PrintK("Could not allocate a kernel stack for thread %d.\n",
+				(uint64_t) pcb->tid);
+		return;
+	}
+
+	bool waking = pcb->state == TASK_BLOCKED;
+	if(waking) {
+		// If the task blocked but its CPU has not switched away from it yet,
+		// let it carry on there.
+		run_queue_t *old = &percpu_of(pcb->cpu)->rq;
+		uint64_t rflags = spin_lock_irqsave(&old->lock);
+		bool still_current = old->current == pcb;
+		if(still_current) {
+			pcb->state = TASK_RUNNING;
+		}
+		spin_unlock_irqrestore(&old->lock, rflags);
+		if(still_current) {
+			return;
+		}
+	}
+
+	run_queue_t *rq = select_rq(pcb, waking);
+	uint64_t rflags = spin_lock_irqsave(&rq->lock);
+	bool was_queued = rq_has_queued(rq);
+	if(waking && pcb->cpu != rq->idle.cpu) {
+		++pcb->migrations;
+		sched_trace_migrate(pcb->tid, pcb->cpu, rq->idle.cpu, rq->nr_running + 1);
+	}
+	pcb->cpu		= rq->idle.cpu;
+	pcb->state		= TASK_RUNNABLE;
+	pcb->wakeup_tsc	= rdtsc();
+	// New and woken tasks start on the active array, with a fresh slice if
+	// they had used theirs up.
+	if(!pcb->slice_left) {
+		pcb->slice_left = task_slice(pcb);
+	}
+	enqueue(rq->active, pcb);
+	++rq->nr_running;
+	sched_trace_event(SCHED_EV_WAKEUP, pcb->tid, rq->nr_running, rq->idle.cpu);
+	// The CPU is only ticking if something was already waiting behind a task,
+	// and must be told about one which should preempt its current task.
+	bool kick = rq->current == &rq->idle || !was_queued ||
+				pcb->prio < rq->current->prio;
+	spin_unlock_irqrestore(&rq->lock, rflags);
+
+	if(kick) {
+		resched_cpu(rq);
+	}
+}
+
+void
+unschedule_task(pcb_t *pcb)
+{
+	run_queue_t *rq = &percpu_of(pcb->cpu)->rq;
+	uint64_t rflags = spin_lock_irqsave(&rq->lock);
+	if(pcb->state == TASK_RUNNABLE) {
+		if(!remove(rq->active, pcb)) {
+			remove(rq->expired, pcb);
+		}
+		--rq->nr_running;
+	}
+	// A running task is dropped from the queue at its CPU's next switch.
+	pcb->state = TASK_BLOCKED;
+	spin_unlock_irqrestore(&rq->lock, rflags);
+
+	if(pcb == current_task()) {
+		context_switch();
+	}
+}
+
+void
+exit_current_task()
+{
+	run_queue_t *rq = &this_cpu()->rq;
+	uint64_t rflags = spin_lock_irqsave(&rq->lock);
+	rq->current->state = TASK_DEAD;
+	spin_unlock_irqrestore(&rq->lock, rflags);
+
+	fpu_release(rq->current);
+
+	// A dead task is never switched back to.
+	context_switch();
+	for(;;) {
+		__asm__ volatile("hlt");
+	}
+}
+
+void
+set_fs_base(uint64_t base)
+{
+	uint64_t rflags = irq_save();
+	run_queue_t *rq = &this_cpu()->rq;
+	rq->current->fs_base	= base;
+	rq->loaded_fs_base		= base;
+	wrmsr(MSR_FS_BASE, base);
+	irq_restore(rflags);
+}
+
+void
+sched_set_nice(pcb_t *pcb, int8_t nice)
+{
+	// The queues go by pcb->prio, so a queued task is unaffected until it is
+	// next queued.
+	__atomic_store_n(&pcb->nice, nice, __ATOMIC_RELAXED);
+}
+
+bool
+sched_set_affinity(pcb_t *pcb, cpu_mask_t mask)
+{
+	if(mask != CPU_MASK_NONE && !(mask & online_cpus())) {
+		return false;
+	}
+	__atomic_store_n(&pcb->affinity, mask, __ATOMIC_RELAXED);
+
+	for(;;) {
+		uint32_t cpu = __atomic_load_n(&pcb->cpu, __ATOMIC_RELAXED);
+		if(task_allowed(pcb, cpu)) {
+			return true;
+		}
+
+		run_queue_t *rq = &percpu_of(cpu)->rq;
+		uint64_t rflags = spin_lock_irqsave(&rq->lock);
+		if(pcb->cpu != cpu) {
+			// Stolen meanwhile; look again.
+			spin_unlock_irqrestore(&rq->lock, rflags);
+			continue;
+		}
+		bool queued		= pcb->state == TASK_RUNNABLE;
+		bool running	= rq->current == pcb;
+		if(queued) {
+			if(!remove(rq->active, pcb)) {
+				remove(rq->expired, pcb);
+			}
+			--rq->nr_running;
+			pcb->state = TASK_BLOCKED;
+		}
+		spin_unlock_irqrestore(&rq->lock, rflags);
+
+		// A blocked task is placed according to its new mask when woken, and
+		// a running one is moved off at its next switch.
+		if(queued) {
+			schedule_task(pcb);
+		} else if(running && pcb == current_task()) {
+			context_switch();
+		} else if(running) {
+			resched_cpu(rq);
+		}
+		return true;
+	}
+}
+
+void
+context_switch()
+{
+	uint64_t rflags = irq_save();
+	schedule();
+	irq_restore(rflags);
+}
+
+pcb_t*
+current_task()
+{
+	return percpu_read(rq.current);
+}
@@ -1,27 +1,177 @@
-#ifdef SCHED_H
+#ifndef SCHED_H
 #define SCHED_H
 
 #include "proc/proc.h"
+#include "hal/timer.h"
+#include "utils/spin_lock.h"
 #include <stdint.h>
+#include <stdbool.h>
 
+// Number of priority levels, one per bit of prio_array_t.bitmap. 0 is the
+// highest.
+#define SCHED_NUM_PRIOS			64
+// Priority of a task with nice 0.
+#define SCHED_DEFAULT_PRIO		32
+// Length of a time slice at SCHED_DEFAULT_PRIO, in microseconds. Slices grow
+// linearly towards twice this at priority 0, and shrink towards 0 at the
+// lowest priority.
+#define SCHED_SLICE_US			10000
+// IPI by which a CPU asks another to look at its run queue.
+#define RESCHED_VECTOR			0x32
+// A task which ran on its CPU within this many microseconds is assumed to still
+// have its working set in that CPU's caches, and is not stolen by others...
+#define SCHED_MIGRATION_COST_US	500
+// ...unless this many attempts in a row found only such tasks.
+#define SCHED_MAX_FAILED_STEALS	4
+
+/** Priority array.
+ * One FIFO of tasks per priority, and a bitmap of which are non-empty, so the
+ * highest priority task is found with a single bit scan however many tasks
+ * are queued.
+**/
+typedef struct {
+	uint64_t bitmap;
+	pcb_t *head[SCHED_NUM_PRIOS];
+	pcb_t *tail[SCHED_NUM_PRIOS];
+} prio_array_t;
+
+/** Idle residency of one CPU. **/
+typedef struct {
+	// TSC ticks spent waiting in hlt or mwait.
+	uint64_t idle_tsc;
+	// Times the CPU went idle.
+	uint64_t entries;
+	// Wakeups made by storing to the CPU's monitored flag, sparing an IPI.
+	uint64_t ipis_saved;
+} idle_stats_t;
+
+/** Per-CPU run queue.
+ * Lives in the CPU's percpu_t. Other CPUs enqueue tasks onto it and steal
+ * from it, so every field other than idle is protected by lock.
+**/
+typedef struct {
+	spin_lock_t lock;
+	// Runnable tasks with some of their slice left, and those which have used
+	// it up. Tasks run from active only; once it is empty, the two are
+	// swapped and every slice refilled, so even the lowest priority task gets
+	// a slice per round.
+	prio_array_t *active;
+	prio_array_t *expired;
+	prio_array_t arrays[2];
+	// Queued tasks plus the current one, not counting idle.
+	volatile uint32_t nr_running;
+	// Ends the current task's slice. Armed only while other tasks are queued,
+	// so a CPU running a single task, or idling, takes no timer interrupts.
+	// Only touched by the owning CPU.
+	timer_event_t slice_timer;
+	// Set when the current task should be switched out: on the way out of
+	// an interrupt, or once it leaves a non-preemptible section.
+	volatile bool need_resched;
+	// Consecutive steals which only found cache-hot tasks.
+	uint32_t failed_steals;
+	pcb_t *current;
+	// The task whose kernel stack we are leaving, until the switch is done.
+	pcb_t *prev;
+	// Set if prev is no longer allowed on this CPU, and must be queued
+	// elsewhere once off its stack.
+	bool migrate_prev;
+	// The address space currently in CR3.
+	uint64_t loaded_cr3;
+	// The user thread pointer currently in FS.base.
+	uint64_t loaded_fs_base;
+	// The CPU's boot context, which ends up in sched_idle.
+	pcb_t idle;
+	volatile bool online;
+	idle_stats_t idle_stats;
+	// Set while the CPU waits in mwait on this flag, so that clearing it
+	// wakes the CPU without an interrupt. On a cache line of its own so that
+	// nothing else written to the queue wakes it.
+	volatile bool polling __attribute__((aligned(64)));
+} run_queue_t;
+
+/**
+ * Set up the scheduler on the BSP. APs set up their own run queues through
+ * local_init_scheduler.
+ * @input num_cpus The number of CPUs across which to spread tasks.
+ */
 void
 global_init_scheduler(uint8_t num_cpus);
 
+/**
+ * Make the calling context this CPU's idle task, and start the timer which
+ * preempts it.
+ */
 void
 local_init_scheduler();
 
+/**
+ * Make the calling context this CPU's idle loop, which runs whatever is queued
+ * and otherwise waits, in mwait if the CPU supports it and hlt if not. Does
+ * not return.
+ */
+void
+sched_idle();
+
+/**
+ * @input cpu Index of a CPU.
+ * @output A snapshot of its idle residency.
+ */
+idle_stats_t
+sched_idle_stats(uint32_t cpu);
+
+/**
+ * Queue a new or blocked task on the least loaded CPU.
+ */
 void
 schedule_task(pcb_t *pcb);
 
+/**
+ * Take a task off the run queues until it is passed to schedule_task again.
+ * If it is the calling task, give up the CPU immediately.
+ */
 void
 unschedule_task(pcb_t *pcb);
 
+/**
+ * Stop the calling task for good and switch to the next one. Does not return.
+ */
 void
 exit_current_task();
 
+/**
+ * Change a task's priority to SCHED_DEFAULT_PRIO + nice, clamped to the valid
+ * range. Takes effect from the task's next slice.
+ */
+void
+sched_set_nice(pcb_t *pcb, int8_t nice);
+
+/**
+ * Restrict a task to a set of CPUs. A task queued or running elsewhere is
+ * moved onto one of them.
+ * @input mask The allowed CPUs; CPU_MASK_NONE allows any.
+ * @output false, changing nothing, if mask holds no online CPU.
+ */
+bool
+sched_set_affinity(pcb_t *pcb, cpu_mask_t mask);
+
+/**
+ * Set the calling user thread's thread pointer, i.e. FS.base, which is saved
+ * and restored with the thread from now on.
+ * @input base A canonical user address.
+ */
+void
+set_fs_base(uint64_t base);
 
+/**
+ * Give up the CPU to the next runnable task on this CPU's queue.
+ */
 void
 context_switch();
 
-#endif
+/**
+ * @output The task running on this CPU (its idle task if there is none).
+ */
+pcb_t*
+current_task();
 
+#endif
@@ -0,0 +1,125 @@
+#ifdef FAIRNESS_BENCH
+#include "proc/sched_bench.h"
+#include "proc/sched.h"
+#include "proc/kthread.h"
+#include "hal/cpu.h"
+#include "hal/percpu.h"
+#include "hal/timer.h"
+#include "utils/printf.h"
+
+static const int8_t NICES[] = FAIRNESS_BENCH_NICES;
+#define NUM_SPINNERS	(sizeof(NICES) / sizeof(NICES[0]))
+
+static pcb_t *SPINNERS[NUM_SPINNERS];
+static volatile bool STOP;
+// Wakes the controller once the spinners have run for FAIRNESS_BENCH_MS.
+static timer_event_t WAKEUP;
+
+static void
+spinner_main(void *arg)
+{
+	while(!STOP) {
+		cpu_relax();
+	}
+}
+
+static void
+wake_controller(void *arg)
+{
+	schedule_task(arg);
+}
+
+/**
+ * @output A task's weight at the given nice value: its slice length, as
+ * 		   task_slice in proc/sched.c gives it, in units of
+ * 		   SCHED_SLICE_US / (SCHED_NUM_PRIOS - SCHED_DEFAULT_PRIO).
+ */
+static uint64_t
+slice_weight(int8_t nice)
+{
+	int32_t prio = SCHED_DEFAULT_PRIO + nice;
+	prio = prio < 0 ? 0 : prio >= SCHED_NUM_PRIOS ? SCHED_NUM_PRIOS - 1 : prio;
+	return SCHED_NUM_PRIOS - prio;
+}
+
+/**
+ * Start the spinners, sleep while they run, and report their shares. Runs at
+ * the highest priority, so that it runs as soon as it wakes and the
+ * spinners' runtimes are read while none of them is running.
+ */
+static void
+controller_main(void *arg)
+{
+	pcb_t *self = current_task();
+	for(uint32_t i = 0; i < NUM_SPINNERS; ++i) {
+		SPINNERS[i] = kthread_create(&spinner_main, NULL);
+		if(!SPINNERS[i]) {
+			PrintK("Could not create the fairness benchmark's threads.\n");
+			while(i--) {
+				free_task(SPINNERS[i]);
+			}
+			return;
+		}
+		SPINNERS[i]->affinity	= cpu_mask_of(0);
+		SPINNERS[i]->nice		= NICES[i];
+	}
+	for(uint32_t i = 0; i < NUM_SPINNERS; ++i) {
+		schedule_task(SPINNERS[i]);
+	}
+
+	// As in the workqueue worker, interrupts stay disabled until we have
+	// switched away, so the wakeup cannot come first.
+	uint64_t rflags		= irq_save();
+	WAKEUP.deadline		= rdtsc() + us_to_tsc(FAIRNESS_BENCH_MS * 1000);
+	WAKEUP.callback		= &wake_controller;
+	WAKEUP.arg			= self;
+	timer_add(&WAKEUP);
+	unschedule_task(self);
+	irq_restore(rflags);
+
+	uint64_t runtime[NUM_SPINNERS];
+	uint64_t total_runtime = 0, total_weight = 0;
+	for(uint32_t i = 0; i < NUM_SPINNERS; ++i) {
+		runtime[i]		= SPINNERS[i]->runtime;
+		total_runtime	+= runtime[i];
+		total_weight	+= slice_weight(NICES[i]);
+	}
+	// The spinners exit, freeing their pcbs, once they see this.
+	STOP = true;
+	if(!total_runtime) {
+		PrintK("Fairness: the threads did not run.\n");
+		return;
+	}
+
+	uint32_t failed = 0;
+	for(uint32_t i = 0; i < NUM_SPINNERS; ++i) {
+		uint64_t share		= runtime[i] * 1000 / total_runtime;
+		uint64_t expected	= slice_weight(NICES[i]) * 1000 / total_weight;
+		bool ok = share + FAIRNESS_BENCH_TOLERANCE >= expected &&
+				  share <= expected + FAIRNESS_BENCH_TOLERANCE;
+		failed += !ok;
+		PrintK("Fairness: nice %c%d: %d/1000 of the CPU, expected %d/1000%s\n",
+			   (uint64_t) (NICES[i] < 0 ? '-' : '+'),
+			   (uint64_t) (NICES[i] < 0 ? -NICES[i] : NICES[i]),
+			   share, expected, ok ? "." : ", off.");
+	}
+	PrintK("Fairness: %d of %d threads off by more than %d/1000.\n",
+		   (uint64_t) failed, (uint64_t) NUM_SPINNERS,
+		   (uint64_t) FAIRNESS_BENCH_TOLERANCE);
+}
+
+void
+fairness_bench_start()
+{
+	pcb_t *controller = kthread_create(&controller_main, NULL);
+	if(!controller) {
+		PrintK("Could not create the fairness benchmark's threads.\n");
+		return;
+	}
+	// On CPU 0 with the spinners, as its wakeup fires on the CPU which armed
+	// it.
+	controller->affinity	= cpu_mask_of(0);
+	controller->nice		= -SCHED_DEFAULT_PRIO;
+	schedule_task(controller);
+}
+#endif
@@ -0,0 +1,37 @@
+#ifndef SCHED_BENCH_H
+#define SCHED_BENCH_H
+
+#include <stdint.h>
+
+// Nice values of the spinning tasks.
+#define FAIRNESS_BENCH_NICES		{ -16, -8, 0, 8, 16 }
+// How long the tasks spin for.
+#define FAIRNESS_BENCH_MS			3000
+// How far, in thousandths of the CPU, a task's share may stray from its
+// expected one.
+#define FAIRNESS_BENCH_TOLERANCE	20
+
+/** Scheduler fairness benchmark ("make bench-fairness").
+ * Spins one kernel thread per FAIRNESS_BENCH_NICES entry on CPU 0 for
+ * FAIRNESS_BENCH_MS, then prints each one's share of their total runtime
+ * next to its expected share. Every runnable task gets one slice per round,
+ * so a task's expected share is its slice length over the sum of theirs:
+ * with slices of SCHED_SLICE_US * (SCHED_NUM_PRIOS - prio) /
+ * (SCHED_NUM_PRIOS - SCHED_DEFAULT_PRIO), in proportion to
+ * SCHED_NUM_PRIOS - prio. A task whose share is further than
+ * FAIRNESS_BENCH_TOLERANCE from that is flagged.
+**/
+
+#ifdef FAIRNESS_BENCH
+/**
+ * Start the benchmark, which runs once the scheduler does. Must run after
+ * global_init_scheduler.
+ */
+void
+fairness_bench_start();
+#else
+static inline void
+fairness_bench_start() {}
+#endif
+
+#endif
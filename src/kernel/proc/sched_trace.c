@@ -0,0 +1,194 @@
+#ifdef SCHED_TRACE
+#include "proc/sched_trace.h"
+#include "proc/sched.h"
+#include "proc/workqueue.h"
+#include "hal/cpu.h"
+#include "hal/percpu.h"
+#include "hal/timer.h"
+#include "interrupts/io.h"
+#include "memory_management/physical_memory_manager.h"
+#include "memory_management/virtual_memory_manager.h"
+#include "utils/printf.h"
+
+/** One CPU's trace.
+ * Only its own CPU writes the ring and histogram, with interrupts disabled.
+ * The dump reads them from another CPU, so head is published with release
+ * ordering, and events overwritten while being read are detected and dropped.
+**/
+typedef struct {
+	sched_event_t *events;
+	// Events ever written, and ever read by the dump.
+	volatile uint64_t head;
+	uint64_t tail;
+	uint64_t lost;
+	uint64_t wakeup_hist[SCHED_TRACE_BUCKETS];
+	uint64_t switches;
+	volatile uint64_t migrations_in;
+} __attribute__((aligned(CACHE_LINE_SIZE))) sched_trace_t;
+
+static sched_trace_t SCHED_TRACE_CPUS[MAX_CPUS];
+
+static void dump_work_fn(work_t *work);
+static work_t DUMP_WORK = WORK_INIT(&dump_work_fn);
+static timer_event_t DUMP_TIMER;
+#ifdef SCHED_TRACE_EXIT_AFTER
+static uint32_t DUMPS;
+#endif
+
+static void
+debugcon_puts(const char *s)
+{
+	while(*s) {
+		outportb(DEBUGCON_PORT, *s++);
+	}
+}
+
+static void
+debugcon_putu(uint64_t n)
+{
+	char buf[21];
+	int i = sizeof(buf) - 1;
+	buf[i] = '\0';
+	do {
+		buf[--i] = '0' + n % 10;
+		n /= 10;
+	} while(n);
+	debugcon_puts(&buf[i]);
+}
+
+// Write a record: its name, then each field preceded by a comma.
+static void
+debugcon_record(const char *name, const uint64_t *fields, int num_fields)
+{
+	debugcon_puts(name);
+	for(int i = 0; i < num_fields; ++i) {
+		debugcon_puts(",");
+		debugcon_putu(fields[i]);
+	}
+	debugcon_puts("\n");
+}
+
+static void
+dump_cpu(uint32_t cpu)
+{
+	sched_trace_t *trace = &SCHED_TRACE_CPUS[cpu];
+	uint64_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+	if(head - trace->tail > SCHED_TRACE_EVENTS) {
+		trace->lost += head - trace->tail - SCHED_TRACE_EVENTS;
+		trace->tail = head - SCHED_TRACE_EVENTS;
+	}
+
+	for(; trace->tail < head; ++trace->tail) {
+		sched_event_t ev = trace->events[trace->tail % SCHED_TRACE_EVENTS];
+		// If the writer has lapped us since, the copy may be torn.
+		uint64_t now_head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+		if(now_head - trace->tail >= SCHED_TRACE_EVENTS) {
+			++trace->lost;
+			continue;
+		}
+		uint64_t fields[] = { cpu, ev.tsc, ev.type, ev.pid, ev.nr_running, ev.arg };
+		debugcon_record("ev", fields, 6);
+	}
+
+	for(uint32_t i = 0; i < SCHED_TRACE_BUCKETS; ++i) {
+		uint64_t count = __atomic_load_n(&trace->wakeup_hist[i], __ATOMIC_RELAXED);
+		if(count) {
+			uint64_t fields[] = { cpu, 1ull << i, count };
+			debugcon_record("hist", fields, 3);
+		}
+	}
+
+	idle_stats_t idle = sched_idle_stats(cpu);
+	uint64_t fields[] = {
+		cpu, __atomic_load_n(&trace->switches, __ATOMIC_RELAXED),
+		trace->migrations_in, trace->lost, idle.idle_tsc
+	};
+	debugcon_record("cpu", fields, 5);
+}
+
+static void
+dump_work_fn(work_t *work)
+{
+	uint64_t hz = tsc_hz();
+	debugcon_record("tsc_hz", &hz, 1);
+	for(uint32_t i = 0; i < num_cpus(); ++i) {
+		dump_cpu(i);
+	}
+
+#ifdef SCHED_TRACE_EXIT_AFTER
+	// Scripted runs end themselves once they have enough data.
+	if(++DUMPS == SCHED_TRACE_EXIT_AFTER) {
+		outportb(DEBUG_EXIT_PORT, 0);
+	}
+#endif
+}
+
+static void
+dump_timer_fn(void *arg)
+{
+	queue_work(&DUMP_WORK);
+	DUMP_TIMER.deadline += us_to_tsc(SCHED_TRACE_DUMP_MS * 1000);
+	timer_add(&DUMP_TIMER);
+}
+
+void
+sched_trace_init()
+{
+	for(uint32_t i = 0; i < num_cpus(); ++i) {
+		void *events = AllocContiguous(SCHED_TRACE_EVENTS * sizeof(sched_event_t));
+		if(!events) {
+			PrintK("Could not allocate a trace ring for CPU %d.\n", (uint64_t) i);
+			continue;
+		}
+		// Written from whatever pagemap is loaded.
+		SCHED_TRACE_CPUS[i].events = (sched_event_t*) ((uintptr_t) events + KERNEL_DATA);
+	}
+
+	uint64_t rflags = irq_save();
+	DUMP_TIMER.callback	= &dump_timer_fn;
+	DUMP_TIMER.deadline	= rdtsc() + us_to_tsc(SCHED_TRACE_DUMP_MS * 1000);
+	timer_add(&DUMP_TIMER);
+	irq_restore(rflags);
+}
+
+void
+sched_trace_event(sched_event_type_t type, uint32_t pid, uint32_t nr_running,
+				  uint64_t arg)
+{
+	sched_trace_t *trace = &SCHED_TRACE_CPUS[cpu_index()];
+	if(!trace->events) {
+		return;
+	}
+
+	sched_event_t *ev = &trace->events[trace->head % SCHED_TRACE_EVENTS];
+	ev->tsc			= rdtsc();
+	ev->pid			= pid;
+	ev->type		= type;
+	ev->nr_running	= nr_running;
+	ev->arg			= arg;
+	__atomic_store_n(&trace->head, trace->head + 1, __ATOMIC_RELEASE);
+
+	if(type == SCHED_EV_SWITCH) {
+		++trace->switches;
+	}
+}
+
+void
+sched_trace_wakeup_latency(uint64_t wakeup_tsc)
+{
+	uint64_t us = (rdtsc() - wakeup_tsc) / us_to_tsc(1);
+	uint32_t bucket = us ? 64 - __builtin_clzll(us) : 0;
+	if(bucket >= SCHED_TRACE_BUCKETS) {
+		bucket = SCHED_TRACE_BUCKETS - 1;
+	}
+	++SCHED_TRACE_CPUS[cpu_index()].wakeup_hist[bucket];
+}
+
+void
+sched_trace_migrate(uint32_t pid, uint32_t from, uint32_t to,
+					uint32_t nr_running)
+{
+	__atomic_fetch_add(&SCHED_TRACE_CPUS[to].migrations_in, 1, __ATOMIC_RELAXED);
+	sched_trace_event(SCHED_EV_MIGRATE, pid, nr_running, (uint64_t) from << 32 | to);
+}
+#endif
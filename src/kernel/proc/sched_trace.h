@@ -0,0 +1,99 @@
+#ifndef SCHED_TRACE_H
+#define SCHED_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Events kept per CPU; older ones are overwritten. Must be a power of 2.
+#define SCHED_TRACE_EVENTS		1024
+// Wakeup latency histogram buckets: bucket i counts latencies of less than
+// 2^i microseconds (and at least 2^(i-1)), the last everything longer.
+#define SCHED_TRACE_BUCKETS		24
+// How often the trace is written out.
+#define SCHED_TRACE_DUMP_MS		1000
+// QEMU's debug console, see "make trace-sched".
+#define DEBUGCON_PORT			0xE9
+// QEMU's isa-debug-exit device, which ends the run when written to.
+#define DEBUG_EXIT_PORT			0xF4
+
+/** Scheduler tracing.
+ * With SCHED_TRACE defined, the scheduler records TSC-stamped events into a
+ * ring per CPU, along with a histogram of wakeup-to-run latency and migration
+ * counts. Every SCHED_TRACE_DUMP_MS, a worker writes what is new to the debug
+ * console, one comma-separated record per line:
+ *
+ *   ev,<cpu>,<tsc>,<type>,<pid>,<nr_running>,<arg>
+ *   hist,<cpu>,<bucket upper bound in us>,<count>
+ *   cpu,<cpu>,<switches>,<migrations in>,<events lost>,<idle tsc>
+ *   tsc_hz,<hz>
+ *
+ * nr_running is the length of the recording CPU's run queue at the time, so
+ * the events also give queue length over time. Without SCHED_TRACE, every
+ * hook compiles to nothing.
+**/
+
+typedef enum {
+	// A task was queued by schedule_task. arg: the target CPU.
+	SCHED_EV_WAKEUP,
+	// pid was switched in. arg: the pid switched out.
+	SCHED_EV_SWITCH,
+	// pid moved CPUs. arg: the source CPU << 32 | the destination CPU.
+	SCHED_EV_MIGRATE,
+	// pid exited. arg: the TSC ticks it ran for in total.
+	SCHED_EV_EXIT
+} sched_event_type_t;
+
+typedef struct {
+	uint64_t tsc;
+	uint32_t pid;
+	uint16_t type;
+	uint16_t nr_running;
+	uint64_t arg;
+} sched_event_t;
+
+#ifdef SCHED_TRACE
+/**
+ * Allocate every CPU's ring and start the periodic dump on the calling CPU.
+ * Must run after workqueue_init.
+ */
+void
+sched_trace_init();
+
+/**
+ * Record an event on the calling CPU's ring. Must be called with interrupts
+ * disabled.
+ */
+void
+sched_trace_event(sched_event_type_t type, uint32_t pid, uint32_t nr_running,
+				  uint64_t arg);
+
+/**
+ * Record, on the calling CPU, that a task queued at wakeup_tsc has just
+ * started running. Must be called with interrupts disabled.
+ */
+void
+sched_trace_wakeup_latency(uint64_t wakeup_tsc);
+
+/**
+ * Count a migration onto CPU to, and record it on the calling CPU's ring.
+ */
+void
+sched_trace_migrate(uint32_t pid, uint32_t from, uint32_t to,
+					uint32_t nr_running);
+#else
+static inline void
+sched_trace_init() {}
+
+static inline void
+sched_trace_event(sched_event_type_t type, uint32_t pid, uint32_t nr_running,
+				  uint64_t arg) {}
+
+static inline void
+sched_trace_wakeup_latency(uint64_t wakeup_tsc) {}
+
+static inline void
+sched_trace_migrate(uint32_t pid, uint32_t from, uint32_t to,
+					uint32_t nr_running) {}
+#endif
+
+#endif
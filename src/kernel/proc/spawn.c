@@ -0,0 +1,36 @@
+#include "proc/spawn.h"
+#include "proc/elf.h"
+#include "proc/image_cache.h"
+#include "proc/sched.h"
+#include "proc/ptable.h"
+#include "memory_management/kheap.h"
+#include "vfs/initrd.h"
+
+int64_t
+spawn(const char *const path, process_t *parent)
+{
+	void *ustar = initrd();
+	image_t *image = ustar ? image_get(ustar, path) : NULL;
+	if(!image) {
+		return -1;
+	}
+
+	pcb_t *pcb = kalloc(sizeof(pcb_t));
+	if(!pcb) {
+		image_put(image);
+		return -1;
+	}
+	int loaded = load_image(image, pcb);
+	// The process holds its own reference now, if it got that far.
+	image_put(image);
+	int64_t pid = loaded == 0 ? ptable_add(pcb) : -1;
+	if(pid < 0) {
+		free_task(pcb);
+		return -1;
+	}
+
+	pcb->proc->pid = pid;
+	ptable_link(pcb->proc, parent);
+	schedule_task(pcb);
+	return pid;
+}
@@ -0,0 +1,23 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <stdint.h>
+#include "proc/proc.h"
+
+/**
+ * Create a process running an executable from the initrd, and schedule it:
+ * posix_spawn, rather than fork and exec. The executable comes from the image
+ * cache (see proc/image_cache.h), and the process' segments are faulted in as
+ * it touches them, so this costs little beyond a page table, a stack and a
+ * PCB.
+ * @input path The executable's name in the initrd, e.g.
+ * 			   "./userspace/fetch.elf".
+ * @input parent The new process' parent, NULL for an orphan, e.g. when the
+ * 				 kernel spawns it.
+ * @output The new process' PID, -1 if the executable does not exist or is not
+ * 		   valid, or memory ran out.
+ */
+int64_t
+spawn(const char *const path, process_t *parent);
+
+#endif
@@ -0,0 +1,27 @@
+bits 64
+
+GLOBAL switch_to
+; Switch kernel stacks from the calling task to another.
+; Everything the ABI lets a callee clobber is already saved by the caller (or
+; by the interrupt stub which entered the kernel), so only the callee-saved
+; registers and the return address are kept on the old stack.
+; @input rdi Where to save the calling task's stack pointer.
+; @input rsi The stack pointer saved by the next task's switch_to, or built by
+;			 init_task_context.
+switch_to:
+	push rbp
+	push rbx
+	push r12
+	push r13
+	push r14
+	push r15
+	mov [rdi], rsp
+
+	mov rsp, rsi
+	pop r15
+	pop r14
+	pop r13
+	pop r12
+	pop rbx
+	pop rbp
+	ret
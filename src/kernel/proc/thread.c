@@ -0,0 +1,183 @@
+#include "proc/thread.h"
+#include "proc/ptable.h"
+#include "proc/sched.h"
+#include "memory_management/physical_memory_manager.h"
+#include "memory_management/virtual_memory_manager.h"
+#include "memory_management/vm_region.h"
+#include "memory_management/kheap.h"
+#include "utils/string.h"
+
+// The TCB is just the pointer to itself.
+#define TCB_SIZE	sizeof(uint64_t)
+
+static inline uintptr_t
+slot_top(int32_t slot)
+{
+	return THREAD_SLOTS_TOP - (uintptr_t) slot * THREAD_SLOT_SIZE;
+}
+
+// Thread pointers are 16-byte aligned whatever the segment asks for.
+static inline size_t
+tls_align(size_t align)
+{
+	return align < 16 ? 16 : align;
+}
+
+bool
+thread_tls_fits(size_t mem_size, size_t align)
+{
+	align = tls_align(align);
+	if(align > THREAD_TLS_SIZE || mem_size > THREAD_TLS_SIZE) {
+		return false;
+	}
+	size_t block_size = (mem_size + align - 1) & ~(align - 1);
+	return TCB_SIZE + (align - 1) + block_size <= THREAD_TLS_SIZE;
+}
+
+/**
+ * Copy bytes into a process' memory through the higher-half mapping of
+ * physical memory, mapping fresh pages where there are none, so that the
+ * process' pagemap need not be loaded. The process' lock must be held.
+ * @input src The bytes to copy, NULL to write zeroes.
+ * @output True on success, false if memory ran out.
+ */
+static bool
+write_user(process_t *proc, uintptr_t dst, const uint8_t *src, size_t len)
+{
+	while(len) {
+		uintptr_t page = dst & ~((uintptr_t) FRAME_SIZE - 1);
+		uint64_t *pte = GetPage(proc->pagemap, page);
+		if(!pte || !(*pte & PRESENT)) {
+			void *frame = AllocFirstFrame();
+			if(!frame) {
+				return false;
+			}
+			if(!MapPage(proc->pagemap, page, (uintptr_t) frame, USER_PAGE)) {
+				FreeFrame(frame);
+				return false;
+			}
+			pte = GetPage(proc->pagemap, page);
+		}
+
+		size_t chunk = page + FRAME_SIZE - dst;
+		chunk = chunk < len ? chunk : len;
+		uint8_t *bytes = (uint8_t*) ((*pte & PAGE_FRAME_MASK) + KERNEL_DATA + (dst - page));
+		if(src) {
+			memmove(bytes, src, chunk);
+			src += chunk;
+		} else {
+			memset(bytes, 0, chunk);
+		}
+		dst += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
+/**
+ * Take the lowest free slot of a process, whose lock must be held.
+ * @output The slot, THREAD_NO_SLOT if all are taken.
+ */
+static int32_t
+alloc_slot(process_t *proc)
+{
+	for(uint32_t i = 0; i < THREAD_SLOTS / 64; ++i) {
+		if(~proc->slots[i]) {
+			uint32_t bit = __builtin_ctzll(~proc->slots[i]);
+			proc->slots[i] |= 1ull << bit;
+			return i * 64 + bit;
+		}
+	}
+	return THREAD_NO_SLOT;
+}
+
+int
+thread_init_user(pcb_t *pcb)
+{
+	process_t *proc = pcb->proc;
+	uint64_t rflags = spin_lock_irqsave(&proc->lock);
+	pcb->slot = alloc_slot(proc);
+	if(pcb->slot == THREAD_NO_SLOT) {
+		spin_unlock_irqrestore(&proc->lock, rflags);
+		return -1;
+	}
+
+	// Slots are taken lowest first, so any slot up to slots_created has been
+	// used before, and only slots_created itself needs a stack region.
+	uintptr_t top		= slot_top(pcb->slot);
+	uintptr_t stack_top	= top - THREAD_TLS_SIZE;
+	if((uint32_t) pcb->slot == proc->slots_created) {
+		if(!vm_region_add(proc, stack_top - THREAD_STACK_SIZE, THREAD_STACK_SIZE,
+						  NULL, 0, USER_PAGE, NULL))
+		{
+			spin_unlock_irqrestore(&proc->lock, rflags);
+			return -1;
+		}
+		++proc->slots_created;
+	}
+
+	size_t align	= tls_align(proc->tls_align);
+	uintptr_t tp	= (top - TCB_SIZE) & ~(align - 1);
+	uintptr_t block	= tp - ((proc->tls_mem_size + align - 1) & ~(align - 1));
+	bool ok = write_user(proc, block, proc->tls_data, proc->tls_file_size) &&
+			  write_user(proc, block + proc->tls_file_size, NULL,
+						 tp - block - proc->tls_file_size) &&
+			  write_user(proc, tp, (const uint8_t*) &tp, TCB_SIZE);
+	spin_unlock_irqrestore(&proc->lock, rflags);
+	if(!ok) {
+		return -1;
+	}
+
+	pcb->fs_base		= tp;
+	pcb->registers.rsp	= stack_top;
+	pcb->registers.rbp	= 0;
+	return 0;
+}
+
+void
+thread_release_slot(pcb_t *pcb)
+{
+	if(pcb->slot == THREAD_NO_SLOT) {
+		return;
+	}
+	process_t *proc = pcb->proc;
+	uint64_t rflags = spin_lock_irqsave(&proc->lock);
+	proc->slots[pcb->slot / 64] &= ~(1ull << (pcb->slot % 64));
+	spin_unlock_irqrestore(&proc->lock, rflags);
+	pcb->slot = THREAD_NO_SLOT;
+}
+
+int64_t
+thread_create(uintptr_t entry, uint64_t arg)
+{
+	// iretq to a non-canonical RIP faults in ring 0, so only user addresses
+	// may get that far.
+	if(entry >= USER_SPACE_END) {
+		return -1;
+	}
+	pcb_t *self = current_task();
+	pcb_t *pcb = kalloc(sizeof(pcb_t));
+	if(!pcb) {
+		return -1;
+	}
+	memset(pcb, 0, sizeof(pcb_t));
+	pcb->slot		= THREAD_NO_SLOT;
+	pcb->proc		= self->proc;
+	pcb->state		= TASK_NEW;
+	pcb->nice		= self->nice;
+	pcb->affinity	= self->affinity;
+	__atomic_add_fetch(&pcb->proc->threads, 1, __ATOMIC_RELAXED);
+
+	pcb->registers.rip = entry;
+	pcb->registers.rdi = arg;
+	if(thread_init_user(pcb) != 0 || ptable_add(pcb) < 0) {
+		free_task(pcb);
+		return -1;
+	}
+	// Enter as if called, with the stack misaligned by a return address.
+	pcb->registers.rsp -= sizeof(uint64_t);
+
+	int64_t tid = pcb->tid;
+	schedule_task(pcb);
+	return tid;
+}
@@ -0,0 +1,70 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "proc/proc.h"
+
+/** User threads.
+ * Every thread of a process runs in the process' pagemap, and has a slot of
+ * its address space, below THREAD_SLOTS_TOP, for its user stack and TLS
+ * block. From the bottom, a slot holds an unmapped guard page, the stack,
+ * which is faulted in as it grows, and THREAD_TLS_SIZE bytes at the top for
+ * the TLS block and the thread control block (TCB).
+ *
+ * TLS follows the x86-64 ELF ABI (variant II): the thread pointer, loaded
+ * into FS.base, points at the TCB, whose first word points at itself, and
+ * the TLS block, a copy of the executable's PT_TLS segment, ends just below
+ * it. Its pages are filled in when the thread is created, as they must be
+ * written before the thread runs.
+ *
+ * A slot is reused once its thread is reaped. Its stack pages stay mapped
+ * until the process exits.
+**/
+
+#define THREAD_SLOTS_TOP	0xC0000000
+#define THREAD_GUARD_SIZE	0x1000
+#define THREAD_STACK_SIZE	0x10000
+#define THREAD_TLS_SIZE		0x4000
+#define THREAD_SLOT_SIZE	(THREAD_GUARD_SIZE + THREAD_STACK_SIZE + THREAD_TLS_SIZE)
+#define THREAD_SLOTS_BOTTOM	(THREAD_SLOTS_TOP - THREAD_SLOTS * THREAD_SLOT_SIZE)
+
+/**
+ * @input mem_size The size of a PT_TLS segment in memory.
+ * @input align Its alignment, a power of 2.
+ * @output Whether a TLS block for it fits in a thread slot.
+ */
+bool
+thread_tls_fits(size_t mem_size, size_t align);
+
+/**
+ * Give a thread of a process a slot, and set up its stack and TLS block.
+ * Sets its initial RSP to the top of the stack, and its FS base.
+ * @input pcb The thread, whose proc is set.
+ * @output 0 on success, -1 if the process has no free slot or memory ran out.
+ * 		   A slot taken is released by free_task in either case.
+ */
+int
+thread_init_user(pcb_t *pcb);
+
+/**
+ * Release a thread's slot, if it has one, for another thread to reuse.
+ * @input pcb The thread, which must not run again.
+ */
+void
+thread_release_slot(pcb_t *pcb);
+
+/**
+ * Create a thread in the calling process, and schedule it. It starts at entry
+ * as if called with arg as its one argument, and must not return from it,
+ * but exit.
+ * @input entry The thread's first instruction.
+ * @input arg Passed in RDI.
+ * @output The new thread's ID, -1 if entry is not a user address, the process
+ * 		   has THREAD_SLOTS threads already or memory ran out.
+ */
+int64_t
+thread_create(uintptr_t entry, uint64_t arg);
+
+#endif
@@ -0,0 +1,499 @@
+#include "proc/uring.h"
+#include "proc/kthread.h"
+#include "proc/sched.h"
+#include "proc/spawn.h"
+#include "proc/image_cache.h"
+#include "hal/cpu.h"
+#include "hal/timer.h"
+#include "memory_management/physical_memory_manager.h"
+#include "memory_management/virtual_memory_manager.h"
+#include "memory_management/vm_region.h"
+#include "memory_management/kheap.h"
+#include "vfs/initrd.h"
+#include "vfs/ustar.h"
+#include "utils/printf.h"
+#include "utils/spin_lock.h"
+#include "utils/string.h"
+
+// URING_OP_WRITE prints this many bytes at a time.
+#define WRITE_CHUNK		256
+
+// The rings at their largest, as uring_setup lays them out, must fit in the
+// address space reserved for them.
+_Static_assert(((sizeof(uring_header_t) + 63) & ~63ul) +
+			   URING_MAX_ENTRIES * sizeof(uring_sqe_t) + 63 +
+			   2 * URING_MAX_ENTRIES * sizeof(uring_cqe_t) <= URING_AREA_SIZE,
+			   "URING_AREA_SIZE cannot hold URING_MAX_ENTRIES");
+
+typedef struct uring {
+	// Protects everything below but the shared memory, which only the lock
+	// holder writes on the kernel's side.
+	spin_lock_t lock;
+	// The shared memory, through the higher-half mapping, and its frames.
+	uring_header_t *header;
+	uring_sqe_t *sqes;
+	uring_cqe_t *cqes;
+	uintptr_t frames;
+	size_t size;
+	// The kernel's own copies of the indices it writes, so that the process
+	// can't make it misplace entries by overwriting them.
+	uint32_t sq_head;
+	uint32_t cq_tail;
+	// SQEs consumed whose CQEs have not been posted yet.
+	uint32_t inflight;
+	// The process whose SQEs these are, until it is torn down.
+	process_t *proc;
+	// References: the process', the poller's, and one per pending sleep.
+	uint32_t refs;
+	// The thread blocked in uring_enter, if any.
+	pcb_t *waiter;
+	// The polling thread, if set up with URING_SETUP_SQPOLL. busy is set while
+	// it runs SQEs, which may use proc.
+	pcb_t *poller;
+	bool poller_sleeping;
+	volatile bool busy;
+	// Set once the process is gone.
+	bool dead;
+} uring_t;
+
+// A pending URING_OP_SLEEP.
+typedef struct {
+	timer_event_t event;
+	uring_t *ring;
+	uint64_t user_data;
+} uring_sleep_t;
+
+static void
+uring_put(uring_t *ring)
+{
+	if(__atomic_sub_fetch(&ring->refs, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+	for(uintptr_t frame = ring->frames; frame < ring->frames + ring->size; frame += FRAME_SIZE) {
+		FreeFrame((void*) frame);
+	}
+	kfree(ring);
+}
+
+/**
+ * Wake a task which blocked on a ring after publishing itself in it, i.e. its
+ * waiter or its poller, and which the caller has just unpublished.
+ */
+static void
+wake(pcb_t *task)
+{
+	// The task published itself with interrupts disabled, then blocked right
+	// away, so this waits out a few instructions at most. Waking it while it
+	// still runs would queue it twice.
+	while(__atomic_load_n(&task->state, __ATOMIC_ACQUIRE) == TASK_RUNNING) {
+		cpu_relax();
+	}
+	schedule_task(task);
+}
+
+/**
+ * Post a CQE for a consumed SQE, and wake the ring's waiter to look at it.
+ */
+static void
+post_cqe(uring_t *ring, uint64_t user_data, int64_t res)
+{
+	uint64_t rflags = spin_lock_irqsave(&ring->lock);
+	uring_cqe_t *cqe = &ring->cqes[ring->cq_tail & (ring->header->cq_entries - 1)];
+	cqe->user_data	= user_data;
+	cqe->res		= res;
+	__atomic_store_n(&ring->header->cq_tail, ++ring->cq_tail, __ATOMIC_RELEASE);
+	--ring->inflight;
+
+	pcb_t *waiter = ring->waiter;
+	ring->waiter = NULL;
+	spin_unlock_irqrestore(&ring->lock, rflags);
+	if(waiter) {
+		wake(waiter);
+	}
+}
+
+/**
+ * Take the next SQE, if there is one and its CQE will fit. The ring's lock
+ * must be held.
+ * @output True if sqe was filled in.
+ */
+static bool
+claim_sqe(uring_t *ring, uring_sqe_t *sqe)
+{
+	uring_header_t *header = ring->header;
+	uint32_t tail		= __atomic_load_n(&header->sq_tail, __ATOMIC_ACQUIRE);
+	uint32_t queued		= ring->cq_tail - __atomic_load_n(&header->cq_head, __ATOMIC_ACQUIRE);
+	if(tail == ring->sq_head || queued + ring->inflight >= header->cq_entries) {
+		return false;
+	}
+	*sqe = ring->sqes[ring->sq_head & (header->sq_entries - 1)];
+	__atomic_store_n(&header->sq_head, ++ring->sq_head, __ATOMIC_RELEASE);
+	++ring->inflight;
+	return true;
+}
+
+static void
+sleep_done(void *arg)
+{
+	uring_sleep_t *sleep = arg;
+	post_cqe(sleep->ring, sleep->user_data, 0);
+	uring_put(sleep->ring);
+	kfree(sleep);
+}
+
+static int64_t
+op_write(process_t *proc, const uring_sqe_t *sqe)
+{
+	char buf[WRITE_CHUNK];
+	for(uint32_t done = 0; done < sqe->len;) {
+		uint32_t chunk = sqe->len - done;
+		chunk = chunk < WRITE_CHUNK - 1 ? chunk : WRITE_CHUNK - 1;
+		if(!vm_copy_in(proc, buf, sqe->addr + done, chunk)) {
+			return -1;
+		}
+		buf[chunk] = 0;
+		PrintK("%s", buf);
+		done += chunk;
+	}
+	return sqe->len;
+}
+
+static int64_t
+op_read(process_t *proc, const uring_sqe_t *sqe)
+{
+	char path[IMAGE_NAME_LEN];
+	void *ustar = initrd();
+	if(!ustar || !vm_copy_string_in(proc, path, (const char*) sqe->arg, sizeof(path))) {
+		return -1;
+	}
+	size_t size;
+	char *data = ustar_find(ustar, path, &size);
+	if(!data) {
+		return -1;
+	}
+	if(sqe->off >= size) {
+		return 0;
+	}
+	size_t len = size - sqe->off;
+	len = len < sqe->len ? len : sqe->len;
+	return vm_copy_out(proc, sqe->addr, data + sqe->off, len) ? (int64_t) len : -1;
+}
+
+static int64_t
+op_spawn(process_t *proc, const uring_sqe_t *sqe)
+{
+	char path[IMAGE_NAME_LEN];
+	if(!vm_copy_string_in(proc, path, (const char*) sqe->addr, sizeof(path))) {
+		return -1;
+	}
+	return spawn(path, proc);
+}
+
+/**
+ * Start a sleep, which completes from the timer interrupt of the calling CPU.
+ * @output False if memory ran out.
+ */
+static bool
+op_sleep(uring_t *ring, const uring_sqe_t *sqe)
+{
+	uring_sleep_t *sleep = kalloc(sizeof(uring_sleep_t));
+	if(!sleep) {
+		return false;
+	}
+	sleep->ring				= ring;
+	sleep->user_data		= sqe->user_data;
+	sleep->event.callback	= &sleep_done;
+	sleep->event.arg		= sleep;
+	sleep->event.armed		= false;
+	sleep->event.next		= NULL;
+	__atomic_add_fetch(&ring->refs, 1, __ATOMIC_RELAXED);
+
+	uint64_t rflags = irq_save();
+	sleep->event.deadline = rdtsc() + us_to_tsc(sqe->arg);
+	timer_add(&sleep->event);
+	irq_restore(rflags);
+	return true;
+}
+
+/**
+ * Consume and run SQEs until there are none, or no room for their CQEs.
+ * @input proc The ring's process, which must stay alive meanwhile.
+ * @output The number consumed.
+ */
+static uint32_t
+submit(uring_t *ring, process_t *proc)
+{
+	uint32_t consumed = 0;
+	for(;;) {
+		uring_sqe_t sqe;
+		uint64_t rflags = spin_lock_irqsave(&ring->lock);
+		bool claimed = claim_sqe(ring, &sqe);
+		spin_unlock_irqrestore(&ring->lock, rflags);
+		if(!claimed) {
+			return consumed;
+		}
+		++consumed;
+
+		int64_t res;
+		switch(sqe.opcode) {
+		case URING_OP_NOP:
+			res = 0;
+			break;
+		case URING_OP_WRITE:
+			res = op_write(proc, &sqe);
+			break;
+		case URING_OP_READ:
+			res = op_read(proc, &sqe);
+			break;
+		case URING_OP_SPAWN:
+			res = op_spawn(proc, &sqe);
+			break;
+		case URING_OP_SLEEP:
+			if(op_sleep(ring, &sqe)) {
+				continue;
+			}
+			res = -1;
+			break;
+		default:
+			res = -1;
+			break;
+		}
+		post_cqe(ring, sqe.user_data, res);
+	}
+}
+
+static inline bool
+sq_empty(uring_t *ring)
+{
+	return __atomic_load_n(&ring->header->sq_tail, __ATOMIC_ACQUIRE) == ring->sq_head;
+}
+
+static void
+poller_main(void *arg)
+{
+	uring_t *ring = arg;
+	uint64_t idle_tsc	= us_to_tsc(URING_SQPOLL_IDLE_US);
+	uint64_t idle_since	= rdtsc();
+	for(;;) {
+		uint64_t rflags = spin_lock_irqsave(&ring->lock);
+		if(ring->dead) {
+			spin_unlock_irqrestore(&ring->lock, rflags);
+			break;
+		}
+		ring->busy = true;
+		spin_unlock_irqrestore(&ring->lock, rflags);
+		uint32_t consumed = submit(ring, ring->proc);
+		__atomic_store_n(&ring->busy, false, __ATOMIC_RELEASE);
+
+		if(consumed) {
+			idle_since = rdtsc();
+			continue;
+		}
+		if(rdtsc() - idle_since < idle_tsc) {
+			cpu_relax();
+			continue;
+		}
+
+		// Advertise that we are going to sleep before looking at the SQ one
+		// last time, so that either we see the process' next SQE, or it sees
+		// the flag and wakes us.
+		rflags = spin_lock_irqsave(&ring->lock);
+		__atomic_or_fetch(&ring->header->flags, URING_SQ_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+		if(!sq_empty(ring) || ring->dead) {
+			__atomic_and_fetch(&ring->header->flags, ~URING_SQ_NEED_WAKEUP, __ATOMIC_RELAXED);
+			spin_unlock_irqrestore(&ring->lock, rflags);
+			continue;
+		}
+		// As in the workqueue worker, interrupts stay disabled until we have
+		// switched away.
+		ring->poller_sleeping = true;
+		spin_unlock(&ring->lock);
+		unschedule_task(ring->poller);
+		irq_restore(rflags);
+		idle_since = rdtsc();
+	}
+	uring_put(ring);
+}
+
+/**
+ * Wake the ring's poller if it sleeps. The ring's lock must be held.
+ * @output The poller to pass to wake, NULL if it is awake.
+ */
+static pcb_t*
+poller_to_wake(uring_t *ring)
+{
+	if(!ring->poller_sleeping) {
+		return NULL;
+	}
+	ring->poller_sleeping = false;
+	__atomic_and_fetch(&ring->header->flags, ~URING_SQ_NEED_WAKEUP, __ATOMIC_RELAXED);
+	return ring->poller;
+}
+
+/**
+ * Map a ring's frames into its process. The process' lock must be held.
+ * @output False, mapping nothing, if memory ran out or the range is not free:
+ * 		   a region or page already there would be shadowed by, or leak under,
+ * 		   the ring's frames.
+ */
+static bool
+map_ring(uring_t *ring, process_t *proc)
+{
+	if(vm_region_overlaps(proc, URING_BASE, URING_BASE + ring->size)) {
+		return false;
+	}
+	for(size_t offset = 0; offset < ring->size; offset += FRAME_SIZE) {
+		uint64_t *pte = GetPage(proc->pagemap, URING_BASE + offset);
+		if(pte && (*pte & PRESENT)) {
+			return false;
+		}
+	}
+
+	for(size_t offset = 0; offset < ring->size; offset += FRAME_SIZE) {
+		if(!MapPage(proc->pagemap, URING_BASE + offset, ring->frames + offset,
+					USER_PAGE | SHARED_FRAME))
+		{
+			while(offset) {
+				offset -= FRAME_SIZE;
+				UnmapPage(proc->pagemap, URING_BASE + offset);
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+int64_t
+uring_setup(uint32_t entries, uint32_t flags)
+{
+	if(!entries || entries > URING_MAX_ENTRIES || (entries & (entries - 1))) {
+		return -1;
+	}
+	process_t *proc = current_task()->proc;
+	if(__atomic_load_n(&proc->uring, __ATOMIC_ACQUIRE)) {
+		return -1;
+	}
+
+	uring_t *ring = kalloc(sizeof(uring_t));
+	if(!ring) {
+		return -1;
+	}
+	memset(ring, 0, sizeof(uring_t));
+	uint32_t sq_offset	= (sizeof(uring_header_t) + 63) & ~63u;
+	uint32_t cq_offset	= (sq_offset + entries * sizeof(uring_sqe_t) + 63) & ~63u;
+	ring->size			= (cq_offset + 2 * entries * sizeof(uring_cqe_t) + FRAME_SIZE - 1) &
+						  ~((size_t) FRAME_SIZE - 1);
+	void *frames = AllocContiguous(ring->size);
+	if(!frames) {
+		kfree(ring);
+		return -1;
+	}
+	ring->frames				= (uintptr_t) frames;
+	ring->header				= (uring_header_t*) (ring->frames + KERNEL_DATA);
+	ring->sqes					= (uring_sqe_t*) ((uintptr_t) ring->header + sq_offset);
+	ring->cqes					= (uring_cqe_t*) ((uintptr_t) ring->header + cq_offset);
+	ring->header->sq_entries	= entries;
+	ring->header->cq_entries	= 2 * entries;
+	ring->header->sq_offset		= sq_offset;
+	ring->header->cq_offset		= cq_offset;
+	ring->proc					= proc;
+	ring->refs					= 1;
+
+	if(flags & URING_SETUP_SQPOLL) {
+		ring->poller = kthread_create(&poller_main, ring);
+		if(!ring->poller) {
+			uring_put(ring);
+			return -1;
+		}
+		ring->refs = 2;
+	}
+
+	uint64_t rflags = spin_lock_irqsave(&proc->lock);
+	bool ok = !proc->uring && map_ring(ring, proc);
+	if(ok) {
+		__atomic_store_n(&proc->uring, ring, __ATOMIC_RELEASE);
+	}
+	spin_unlock_irqrestore(&proc->lock, rflags);
+	if(!ok) {
+		if(ring->poller) {
+			free_task(ring->poller);
+		}
+		ring->refs = 1;
+		uring_put(ring);
+		return -1;
+	}
+
+	if(ring->poller) {
+		schedule_task(ring->poller);
+	}
+	return URING_BASE;
+}
+
+int64_t
+uring_enter(uint32_t min_complete)
+{
+	pcb_t *self = current_task();
+	uring_t *ring = __atomic_load_n(&self->proc->uring, __ATOMIC_ACQUIRE);
+	if(!ring) {
+		return -1;
+	}
+
+	int64_t consumed = 0;
+	uint64_t rflags = spin_lock_irqsave(&ring->lock);
+	if(ring->poller) {
+		pcb_t *poller = sq_empty(ring) ? NULL : poller_to_wake(ring);
+		spin_unlock_irqrestore(&ring->lock, rflags);
+		if(poller) {
+			wake(poller);
+		}
+	} else {
+		spin_unlock_irqrestore(&ring->lock, rflags);
+		consumed = submit(ring, self->proc);
+	}
+
+	uint32_t cq_entries	= ring->header->cq_entries;
+	min_complete		= min_complete < cq_entries ? min_complete : cq_entries;
+	rflags = spin_lock_irqsave(&ring->lock);
+	for(;;) {
+		uint32_t queued = ring->cq_tail -
+						  __atomic_load_n(&ring->header->cq_head, __ATOMIC_ACQUIRE);
+		// Only the poller can consume SQEs meanwhile, and only while awake.
+		bool more = ring->inflight || (ring->poller && !ring->poller_sleeping &&
+									   !sq_empty(ring));
+		if(queued >= min_complete || !more) {
+			break;
+		}
+		if(ring->waiter) {
+			consumed = -1;
+			break;
+		}
+		// Blocks as the poller does; post_cqe wakes us.
+		ring->waiter = self;
+		spin_unlock(&ring->lock);
+		unschedule_task(self);
+		spin_lock(&ring->lock);
+	}
+	spin_unlock_irqrestore(&ring->lock, rflags);
+	return consumed;
+}
+
+void
+uring_release(process_t *proc)
+{
+	uring_t *ring = proc->uring;
+	proc->uring = NULL;
+
+	uint64_t rflags = spin_lock_irqsave(&ring->lock);
+	ring->dead = true;
+	pcb_t *poller = ring->poller ? poller_to_wake(ring) : NULL;
+	spin_unlock_irqrestore(&ring->lock, rflags);
+	if(poller) {
+		wake(poller);
+	}
+	// The poller may be running SQEs against the process; it checks dead
+	// before every batch.
+	while(__atomic_load_n(&ring->busy, __ATOMIC_ACQUIRE)) {
+		context_switch();
+	}
+	uring_put(ring);
+}
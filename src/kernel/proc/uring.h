@@ -0,0 +1,131 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include "proc/proc.h"
+
+/** Submission and completion rings.
+ * A process may set up one pair of rings in memory it shares with the kernel,
+ * through which it issues many operations per kernel entry, or none at all:
+ * it writes submission queue entries (SQEs) and bumps sq_tail, and the kernel
+ * consumes them, runs them, and posts a completion queue entry (CQE) per SQE
+ * at cq_tail, which the process reaps by bumping cq_head. Both are single
+ * producer, single consumer rings of free-running 32-bit indices, masked by
+ * their number of entries, a power of 2.
+ *
+ * The SQEs are consumed either by uring_enter, from the calling thread, or,
+ * with URING_SETUP_SQPOLL, by a kernel thread which polls sq_tail, so the
+ * process need not enter the kernel to submit. Once it has found nothing to
+ * do for URING_SQPOLL_IDLE_US, the poller sets URING_SQ_NEED_WAKEUP and
+ * sleeps until uring_enter wakes it.
+ *
+ * The CQ has twice as many entries as the SQ, and an SQE is only consumed
+ * while its CQE is sure to fit, so completions are never dropped: the SQ
+ * stalls instead until the process reaps some. Operations complete in any
+ * order; user_data tells them apart.
+ *
+ * The rings are mapped at URING_BASE, laid out as a uring_header_t, then the
+ * SQEs at sq_offset and the CQEs at cq_offset from it. The kernel reaches
+ * them through the higher-half mapping of physical memory instead, so the
+ * poller can serve them whatever pagemap is loaded, and sleeps can complete
+ * from interrupt context. The frames outlive the process until every sleep
+ * has completed.
+**/
+
+// Where the rings are mapped in the process.
+#define URING_BASE				0x70000000
+#define URING_MAX_ENTRIES		256
+// Address space kept free for the rings in every process, which holds them at
+// URING_MAX_ENTRIES.
+#define URING_AREA_SIZE			0x10000
+// How long the poller spins on an empty SQ before it sleeps.
+#define URING_SQPOLL_IDLE_US	1000
+
+// uring_setup flags.
+#define URING_SETUP_SQPOLL		(1 << 0)
+
+// uring_header_t.flags.
+#define URING_SQ_NEED_WAKEUP	(1 << 0)
+
+typedef enum {
+	URING_OP_NOP,
+	// Print len bytes at addr to the terminal. Completes with len.
+	URING_OP_WRITE,
+	// Read up to len bytes of the initrd file named by the string at arg,
+	// from offset off, into addr. Completes with the number of bytes read, 0
+	// past the end of the file.
+	URING_OP_READ,
+	// Spawn the initrd executable named by the string at addr as a child of
+	// the process (see proc/spawn.h). Completes with its PID.
+	URING_OP_SPAWN,
+	// Complete with 0 after arg microseconds.
+	URING_OP_SLEEP
+} uring_op_t;
+
+/** Submission queue entry. Operations which fail complete with -1. **/
+typedef struct {
+	uint8_t		opcode;
+	uint8_t		reserved[3];
+	uint32_t	len;
+	uint64_t	off;
+	uint64_t	addr;
+	uint64_t	arg;
+	// Copied into the operation's CQE.
+	uint64_t	user_data;
+} __attribute__((packed)) uring_sqe_t;
+
+/** Completion queue entry. **/
+typedef struct {
+	uint64_t	user_data;
+	int64_t		res;
+} __attribute__((packed)) uring_cqe_t;
+
+/** Start of the shared memory. The indices each side writes are on cache
+ * lines of their own, so that neither side's stores slow down the other's.
+**/
+typedef struct {
+	// Set by uring_setup.
+	uint32_t			sq_entries;
+	uint32_t			cq_entries;
+	uint32_t			sq_offset;
+	uint32_t			cq_offset;
+	// Written by the process.
+	volatile uint32_t	sq_tail __attribute__((aligned(64)));
+	volatile uint32_t	cq_head;
+	// Written by the kernel.
+	volatile uint32_t	sq_head __attribute__((aligned(64)));
+	volatile uint32_t	cq_tail;
+	volatile uint32_t	flags;
+} uring_header_t;
+
+/**
+ * Set up the calling process' rings, and map them at URING_BASE.
+ * @input entries The number of SQEs, a power of 2 up to URING_MAX_ENTRIES.
+ * @input flags URING_SETUP_* flags.
+ * @output URING_BASE, or -1 if entries is invalid, the process already has
+ * 		   rings, something else is mapped where they would go, or memory ran
+ * 		   out.
+ */
+int64_t
+uring_setup(uint32_t entries, uint32_t flags);
+
+/**
+ * Consume and run the calling process' queued SQEs, or, if a poller does,
+ * wake it should it sleep, then wait for CQEs.
+ * @input min_complete Return once this many CQEs are waiting to be reaped, or
+ * 					   as soon as none could be posted without more SQEs.
+ * @output The number of SQEs consumed, -1 if the process has no rings or
+ * 		   another of its threads is waiting on them.
+ */
+int64_t
+uring_enter(uint32_t min_complete);
+
+/**
+ * Detach a process' rings as it is torn down: stop the poller, and free the
+ * rings once no sleep is pending.
+ * @input proc The process, which has rings and no threads left.
+ */
+void
+uring_release(process_t *proc);
+
+#endif
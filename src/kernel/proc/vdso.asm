@@ -0,0 +1,101 @@
+bits 64
+
+; The vDSO's routines (see vdso.h), which vdso_init copies into the text page.
+; They run in user mode at VDSO_TEXT, so jump only within the copy, and reach
+; the data page by its absolute address.
+%define VDSO_DATA				0xBEAFE000
+%define VDSO_MULT				0x00
+%define VDSO_TSC_BASE			0x08
+%define VDSO_REALTIME_OFFSET	0x10
+%define VDSO_SHIFT				0x18
+%define VDSO_GETCPU_RDTSCP		0x1C
+%define VDSO_SEQUENCE			0x20
+%define CLOCK_REALTIME			0
+%define CLOCK_MONOTONIC			1
+%define CPU_NUMBER_SEGSEL		0x4B
+%define NS_PER_SECOND			1000000000
+
+section .rodata
+
+GLOBAL vdso_text_start
+GLOBAL vdso_text_end
+
+align 16
+vdso_text_start:
+; Entry points, at the offsets vdso.h gives them.
+	jmp vdso_clock_gettime
+align 16
+	jmp vdso_getcpu
+
+; @input rdi CLOCK_REALTIME or CLOCK_MONOTONIC.
+; @input rsi Where to store the time, as seconds then nanoseconds.
+; @output rax 0, or -1 for any other clock.
+vdso_clock_gettime:
+	cmp rdi, CLOCK_MONOTONIC
+	ja .invalid
+	mov r8, VDSO_DATA
+.retry:
+	; As read_seqbegin: wait out writers. x86 does not reorder loads, so the
+	; parameters are read after the sequence.
+	mov r9d, [r8 + VDSO_SEQUENCE]
+	test r9d, 1
+	jnz .busy
+	; Keep rdtsc from running ahead of the loads before it.
+	lfence
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	sub rax, [r8 + VDSO_TSC_BASE]
+	mul qword [r8 + VDSO_MULT]
+	mov ecx, [r8 + VDSO_SHIFT]
+	shrd rax, rdx, cl
+	cmp rdi, CLOCK_REALTIME
+	jne .read
+	add rax, [r8 + VDSO_REALTIME_OFFSET]
+.read:
+	; As read_seqretry: start over if a writer ran meanwhile.
+	cmp r9d, [r8 + VDSO_SEQUENCE]
+	jne .retry
+
+	xor edx, edx
+	mov rcx, NS_PER_SECOND
+	div rcx
+	mov [rsi], rax
+	mov [rsi + 8], rdx
+	xor eax, eax
+	ret
+.busy:
+	pause
+	jmp .retry
+.invalid:
+	mov rax, -1
+	ret
+
+; @input rdi Where to store the CPU index, or NULL.
+; @input rsi Where to store the NUMA node, or NULL.
+; @output rax 0.
+vdso_getcpu:
+	mov r8, VDSO_DATA
+	cmp dword [r8 + VDSO_GETCPU_RDTSCP], 0
+	je .segment
+	rdtscp
+	mov eax, ecx
+	jmp .split
+.segment:
+	mov eax, CPU_NUMBER_SEGSEL
+	lsl eax, eax
+.split:
+	test rdi, rdi
+	jz .node
+	mov ecx, eax
+	and ecx, 0xFFF
+	mov [rdi], ecx
+.node:
+	test rsi, rsi
+	jz .done
+	shr eax, 12
+	mov [rsi], eax
+.done:
+	xor eax, eax
+	ret
+vdso_text_end:
@@ -0,0 +1,122 @@
+#include "proc/vdso.h"
+#include "hal/cpu.h"
+#include "hal/percpu.h"
+#include "hal/timer.h"
+#include "memory_management/physical_memory_manager.h"
+#include "memory_management/virtual_memory_manager.h"
+#include "utils/printf.h"
+#include "utils/string.h"
+
+_Static_assert(offsetof(vdso_data_t, mult) == VDSO_MULT,
+			   "VDSO_MULT does not match vdso_data_t");
+_Static_assert(offsetof(vdso_data_t, tsc_base) == VDSO_TSC_BASE,
+			   "VDSO_TSC_BASE does not match vdso_data_t");
+_Static_assert(offsetof(vdso_data_t, realtime_offset) == VDSO_REALTIME_OFFSET,
+			   "VDSO_REALTIME_OFFSET does not match vdso_data_t");
+_Static_assert(offsetof(vdso_data_t, shift) == VDSO_SHIFT,
+			   "VDSO_SHIFT does not match vdso_data_t");
+_Static_assert(offsetof(vdso_data_t, getcpu_rdtscp) == VDSO_GETCPU_RDTSCP,
+			   "VDSO_GETCPU_RDTSCP does not match vdso_data_t");
+_Static_assert(offsetof(vdso_data_t, lock.sequence) == VDSO_SEQUENCE,
+			   "VDSO_SEQUENCE does not match vdso_data_t");
+
+#define CPUID_80000001_EDX_RDTSCP	(1 << 27)
+#define MSR_TSC_AUX					0xC0000103
+// ns = ticks * mult >> CLOCK_SHIFT, which keeps the scaling error of mult below
+// a nanosecond per 4 seconds.
+#define CLOCK_SHIFT					32
+#define NS_PER_SECOND				1000000000ull
+
+extern const uint8_t vdso_text_start[];
+extern const uint8_t vdso_text_end[];
+
+// Physical addresses of the two pages.
+static uintptr_t VDSO_DATA_FRAME;
+static uintptr_t VDSO_TEXT_FRAME;
+static vdso_data_t *DATA;
+
+static bool
+has_rdtscp()
+{
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+	if(eax < 0x80000001) {
+		return false;
+	}
+	cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+	return edx & CPUID_80000001_EDX_RDTSCP;
+}
+
+void
+vdso_init()
+{
+	void *data = AllocFirstFrame();
+	void *text = AllocFirstFrame();
+	if(!data || !text) {
+		PrintK("Could not allocate the vDSO.\n");
+		return;
+	}
+	VDSO_DATA_FRAME = (uintptr_t) data;
+	VDSO_TEXT_FRAME = (uintptr_t) text;
+	memmove((void*) (VDSO_TEXT_FRAME + KERNEL_DATA), vdso_text_start,
+			vdso_text_end - vdso_text_start);
+
+	DATA = (vdso_data_t*) (VDSO_DATA_FRAME + KERNEL_DATA);
+	uint64_t rflags = write_seqlock(&DATA->lock);
+	DATA->shift			= CLOCK_SHIFT;
+	DATA->mult			= (NS_PER_SECOND << CLOCK_SHIFT) / tsc_hz();
+	DATA->getcpu_rdtscp	= has_rdtscp();
+	DATA->tsc_base		= rdtsc();
+	write_sequnlock(&DATA->lock, rflags);
+}
+
+void
+vdso_cpu_init()
+{
+	if(has_rdtscp()) {
+		wrmsr(MSR_TSC_AUX, VDSO_CPU_NUMBER(this_cpu()->cpu_index, 0));
+	}
+}
+
+bool
+vdso_map(uint64_t *pagemap)
+{
+	if(!DATA) {
+		return true;
+	}
+	// Read-only, and never freed with the process' page table.
+	return MapPage(pagemap, VDSO_DATA, VDSO_DATA_FRAME,
+				   PRESENT | USER_ACCESSIBLE | SHARED_FRAME) &&
+		   MapPage(pagemap, VDSO_TEXT, VDSO_TEXT_FRAME,
+				   PRESENT | USER_ACCESSIBLE | SHARED_FRAME);
+}
+
+bool
+vdso_clock_ns(uint32_t clock, uint64_t *ns)
+{
+	if((clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC) || !DATA) {
+		return false;
+	}
+	uint32_t seq;
+	do {
+		seq = read_seqbegin(&DATA->lock);
+		unsigned __int128 ticks = rdtsc() - DATA->tsc_base;
+		*ns = (uint64_t) (ticks * DATA->mult >> DATA->shift);
+		if(clock == CLOCK_REALTIME) {
+			*ns += DATA->realtime_offset;
+		}
+	} while(read_seqretry(&DATA->lock, seq));
+	return true;
+}
+
+void
+vdso_set_realtime(uint64_t ns)
+{
+	if(!DATA) {
+		return;
+	}
+	uint64_t rflags = write_seqlock(&DATA->lock);
+	unsigned __int128 ticks = rdtsc() - DATA->tsc_base;
+	DATA->realtime_offset = ns - (uint64_t) (ticks * DATA->mult >> DATA->shift);
+	write_sequnlock(&DATA->lock, rflags);
+}
@@ -0,0 +1,106 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "utils/seq_lock.h"
+
+/** vDSO.
+ * Two pages mapped into every process, read-only: the data page at VDSO_DATA,
+ * holding the clock's parameters, and the text page at VDSO_TEXT, holding
+ * routines which read them (see proc/vdso.asm), so that processes can tell
+ * the time and find their CPU without entering the kernel. Both are shared by
+ * every process; the kernel writes the data page through the higher-half
+ * mapping of physical memory.
+ *
+ * The clock counts nanoseconds from boot, scaled from the TSC, which is
+ * assumed to be invariant and synchronized across CPUs:
+ *
+ * 	ns = (tsc - tsc_base) * mult >> shift
+ *
+ * the product taken to 128 bits, so that it never overflows. CLOCK_REALTIME
+ * adds realtime_offset to it. Writers update the parameters under the data
+ * page's seqlock, which user-mode readers retry on as kernel readers do.
+ *
+ * The routines follow the SysV calling convention:
+ * 	int clock_gettime(clockid rdi, struct timespec *rsi), at VDSO_CLOCK_GETTIME,
+ * 		returns 0, or -1 for a clock other than CLOCK_REALTIME or
+ * 		CLOCK_MONOTONIC. A timespec is 64-bit seconds then 64-bit nanoseconds.
+ * 	int getcpu(uint32_t *cpu rdi, uint32_t *node rsi), at VDSO_GETCPU, stores
+ * 		the CPU index (see hal/percpu.h) and NUMA node, always 0, through
+ * 		whichever pointers are not NULL, and returns 0. The result may be out of
+ * 		date as soon as it is returned, as the thread may be migrated.
+ * getcpu reads the CPU number from TSC_AUX with rdtscp where the CPU has it,
+ * and otherwise from the limit of a per-CPU GDT segment with lsl (see
+ * gdt/gdt.h), both holding node << 12 | cpu.
+**/
+
+// Just below the lowest thread slot (see proc/thread.h). Must match
+// proc/vdso.asm.
+#define VDSO_DATA				0xBEAFE000
+#define VDSO_TEXT				(VDSO_DATA + 0x1000)
+#define VDSO_CLOCK_GETTIME		(VDSO_TEXT + 0x00)
+#define VDSO_GETCPU				(VDSO_TEXT + 0x10)
+
+#define CLOCK_REALTIME			0
+#define CLOCK_MONOTONIC			1
+
+// TSC_AUX and the per-CPU segment limit.
+#define VDSO_CPU_NUMBER(cpu, node)	((node) << 12 | (cpu))
+
+// Offsets of the fields proc/vdso.asm reads.
+#define VDSO_MULT				0x00
+#define VDSO_TSC_BASE			0x08
+#define VDSO_REALTIME_OFFSET	0x10
+#define VDSO_SHIFT				0x18
+#define VDSO_GETCPU_RDTSCP		0x1C
+#define VDSO_SEQUENCE			0x20
+
+typedef struct {
+	uint64_t mult;
+	uint64_t tsc_base;
+	// Nanoseconds from the Unix epoch to boot.
+	uint64_t realtime_offset;
+	uint32_t shift;
+	// Set if the CPUs have rdtscp.
+	uint32_t getcpu_rdtscp;
+	seq_lock_t lock;
+} vdso_data_t;
+
+/**
+ * Set up the vDSO pages, and start the clock at 0. Must run on the BSP once
+ * it has measured its TSC frequency.
+ */
+void
+vdso_init();
+
+/**
+ * Load the calling CPU's number into TSC_AUX, if it has one.
+ */
+void
+vdso_cpu_init();
+
+/**
+ * Map the vDSO into a process' pagemap.
+ * @output False if memory ran out.
+ */
+bool
+vdso_map(uint64_t *pagemap);
+
+/**
+ * Read a clock, as the vDSO's clock_gettime does.
+ * @input clock CLOCK_REALTIME or CLOCK_MONOTONIC.
+ * @output ns Nanoseconds since the clock's epoch.
+ * @output False for any other clock.
+ */
+bool
+vdso_clock_ns(uint32_t clock, uint64_t *ns);
+
+/**
+ * Set CLOCK_REALTIME.
+ * @input ns Nanoseconds since the Unix epoch.
+ */
+void
+vdso_set_realtime(uint64_t ns);
+
+#endif
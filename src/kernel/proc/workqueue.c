@@ -0,0 +1,86 @@
+#include "proc/workqueue.h"
+#include "proc/kthread.h"
+#include "proc/sched.h"
+#include "hal/cpu.h"
+#include "hal/percpu.h"
+#include "utils/printf.h"
+
+static work_t*
+pop_work(workqueue_t *wq)
+{
+	work_t *work = wq->head;
+	if(work) {
+		wq->head = work->next;
+		if(!wq->head) {
+			wq->tail = NULL;
+		}
+		work->next = NULL;
+	}
+	return work;
+}
+
+static void
+worker_main(void *arg)
+{
+	workqueue_t *wq = arg;
+	for(;;) {
+		uint64_t rflags = irq_save();
+		work_t *work = pop_work(wq);
+		if(!work) {
+			// Interrupts stay disabled until we have switched away, so no
+			// work can be queued between finding the queue empty and
+			// blocking; queue_work wakes us once we have.
+			wq->sleeping = true;
+			unschedule_task(wq->worker);
+			irq_restore(rflags);
+			continue;
+		}
+		irq_restore(rflags);
+
+		__atomic_store_n(&work->pending, false, __ATOMIC_RELEASE);
+		work->fn(work);
+	}
+}
+
+void
+workqueue_init()
+{
+	for(uint32_t i = 0; i < num_cpus(); ++i) {
+		percpu_t *cpu = percpu_of(i);
+		pcb_t *worker = kthread_create(&worker_main, &cpu->wq);
+		if(!worker) {
+			PrintK("Could not create worker for CPU %d.\n", (uint64_t) i);
+			continue;
+		}
+		worker->affinity	= cpu_mask_of(i);
+		worker->nice		= WORKQUEUE_NICE;
+		cpu->wq.worker		= worker;
+		schedule_task(worker);
+	}
+}
+
+bool
+queue_work(work_t *work)
+{
+	if(__atomic_exchange_n(&work->pending, true, __ATOMIC_ACQ_REL)) {
+		return false;
+	}
+
+	uint64_t rflags = irq_save();
+	workqueue_t *wq = &this_cpu()->wq;
+	work->next = NULL;
+	if(wq->tail) {
+		wq->tail->next = work;
+	} else {
+		wq->head = work;
+	}
+	wq->tail = work;
+
+	bool wake = wq->sleeping;
+	wq->sleeping = false;
+	if(wake) {
+		schedule_task(wq->worker);
+	}
+	irq_restore(rflags);
+	return true;
+}
@@ -0,0 +1,59 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "proc/proc.h"
+
+// Worker threads run ahead of ordinary tasks, so that deferred work finishes
+// about as soon as it would have inside the interrupt.
+#define WORKQUEUE_NICE		(-16)
+
+/** Per-CPU deferred work.
+ * Interrupt handlers queue work items instead of doing slow work (rendering,
+ * logging, driver completion) themselves, and return at once. Each CPU has a
+ * kernel thread, pinned to it, which runs the items queued on that CPU in
+ * order, with interrupts enabled.
+ *
+ * Work items are meant to be embedded in whatever they act on, and are
+ * reusable: an item may be queued again as soon as its function starts.
+**/
+
+typedef struct work work_t;
+typedef void (*work_fn_t)(work_t *work);
+
+struct work {
+	work_fn_t fn;
+	// Set from queueing until fn is called.
+	volatile bool pending;
+	work_t *next;
+};
+
+#define WORK_INIT(work_fn)	{ .fn = (work_fn), .pending = false, .next = NULL }
+
+/** A CPU's queue of work items. Only touched by its own CPU, with interrupts
+ * disabled, so needs no lock.
+**/
+typedef struct {
+	work_t *head;
+	work_t *tail;
+	pcb_t *worker;
+	// Set while the worker is blocked waiting for work.
+	bool sleeping;
+} workqueue_t;
+
+/**
+ * Start a worker thread on every online CPU. Must run after the scheduler
+ * and topology are set up.
+ */
+void
+workqueue_init();
+
+/**
+ * Queue work on the calling CPU's workqueue. Safe in interrupt context.
+ * @output false, changing nothing, if the work is already pending.
+ */
+bool
+queue_work(work_t *work);
+
+#endif
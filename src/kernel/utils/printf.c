@@ -1,4 +1,5 @@
 #include "utils/printf.h"
+#include "utils/spin_lock.h"
 #include <stdbool.h>
 
 static inline void PutChar(char c)
@@ -13,7 +14,9 @@ static inline void Puts(char *c)
 		term_write(c, len);
 }
 
-bool IN_USE;
+// PrintK is called from interrupt handlers too, so the lock is always taken
+// with interrupts disabled.
+static spin_lock_t PRINTK_LOCK;
 
 // Needless to say, this is not a faithful implementation of the C stdlib's
 // printf. I treat all ints as quadwords and leave out a bunch of formats,
@@ -22,9 +25,7 @@ bool IN_USE;
 // than sufficient.
 void PrintK(char *str,...)
 {
-	while(IN_USE); 	
-	
-	IN_USE = true;
+	uint64_t rflags = spin_lock_irqsave(&PRINTK_LOCK);
 
 	char *traverse;
 	char *s;
@@ -35,7 +36,8 @@ void PrintK(char *str,...)
 	for(traverse = str; *traverse != '\0'; ++traverse) {
 		do {
 			if(*traverse == '\0') {
-				IN_USE = false;
+				va_end(arg);
+				spin_unlock_irqrestore(&PRINTK_LOCK, rflags);
 				return;
 			}
 			PutChar(*traverse);
@@ -73,7 +75,7 @@ void PrintK(char *str,...)
 	}
 	va_end(arg);	
 	
-	IN_USE = false;
+	spin_unlock_irqrestore(&PRINTK_LOCK, rflags);
 }
 
 char *Convert(uint64_t num, int base)
@@ -0,0 +1,54 @@
+#include "utils/rw_lock.h"
+#include "hal/cpu.h"
+#include "proc/preempt.h"
+
+void
+read_lock(rw_lock_t *lock)
+{
+	preempt_disable_at((uintptr_t) __builtin_return_address(0));
+	for(;;) {
+		uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+		if(!(state & RW_LOCK_WRITER) &&
+		   __atomic_compare_exchange_n(&lock->state, &state, state + 1, true,
+									   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			return;
+		}
+		cpu_relax();
+	}
+}
+
+void
+read_unlock(rw_lock_t *lock)
+{
+	__atomic_fetch_sub(&lock->state, 1, __ATOMIC_RELEASE);
+	preempt_enable_at((uintptr_t) __builtin_return_address(0));
+}
+
+void
+write_lock(rw_lock_t *lock)
+{
+	preempt_disable_at((uintptr_t) __builtin_return_address(0));
+	// Claim the writer bit, which stops new readers from entering...
+	for(;;) {
+		uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+		if(!(state & RW_LOCK_WRITER) &&
+		   __atomic_compare_exchange_n(&lock->state, &state,
+									   state | RW_LOCK_WRITER, true,
+									   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			break;
+		}
+		cpu_relax();
+	}
+
+	// ...then wait for the readers already inside to leave.
+	while(__atomic_load_n(&lock->state, __ATOMIC_ACQUIRE) != RW_LOCK_WRITER) {
+		cpu_relax();
+	}
+}
+
+void
+write_unlock(rw_lock_t *lock)
+{
+	__atomic_store_n(&lock->state, 0, __ATOMIC_RELEASE);
+	preempt_enable_at((uintptr_t) __builtin_return_address(0));
+}
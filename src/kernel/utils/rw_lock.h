@@ -0,0 +1,32 @@
+#ifndef RW_LOCK_H
+#define RW_LOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RW_LOCK_WRITER		(1U << 31)
+
+/** Reader-writer spinlock.
+ * Any number of readers may hold the lock at once, or a single writer. The
+ * low 31 bits of "state" count readers and the top bit is set by a writer,
+ * which then waits for the readers to drain. New readers back off while the
+ * writer bit is set, so writers cannot be starved. A zeroed rw_lock_t is
+ * unlocked.
+**/
+typedef struct {
+	volatile uint32_t state;
+} rw_lock_t;
+
+void
+read_lock(rw_lock_t *lock);
+
+void
+read_unlock(rw_lock_t *lock);
+
+void
+write_lock(rw_lock_t *lock);
+
+void
+write_unlock(rw_lock_t *lock);
+
+#endif
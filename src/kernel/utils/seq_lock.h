@@ -0,0 +1,72 @@
+#ifndef SEQ_LOCK_H
+#define SEQ_LOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "utils/spin_lock.h"
+#include "hal/cpu.h"
+
+/** Sequence lock.
+ * For data which is read far more often than it is written. Readers never
+ * write to the lock, so they do not contend for its cache line; instead they
+ * retry if a writer ran concurrently:
+ *
+ * 	uint32_t seq;
+ * 	do {
+ * 		seq = read_seqbegin(&lock);
+ * 		...copy the protected data...
+ * 	} while(read_seqretry(&lock, seq));
+ *
+ * Writers serialize on an embedded spinlock and make "sequence" odd for the
+ * duration of the write. Readers must only copy data out, never follow
+ * pointers which a writer could free. A zeroed seq_lock_t is unlocked.
+**/
+typedef struct {
+	volatile uint32_t sequence;
+	spin_lock_t lock;
+} seq_lock_t;
+
+static inline uint32_t
+read_seqbegin(seq_lock_t *seq_lock)
+{
+	uint32_t sequence;
+	while((sequence = __atomic_load_n(&seq_lock->sequence, 
+									  __ATOMIC_ACQUIRE)) & 1) {
+		cpu_relax();
+	}
+	return sequence;
+}
+
+static inline bool
+read_seqretry(seq_lock_t *seq_lock, uint32_t sequence)
+{
+	// Order the reader's loads of the protected data before the re-check.
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&seq_lock->sequence, __ATOMIC_RELAXED) != sequence;
+}
+
+/**
+ * Begin a write. Interrupts are disabled until write_sequnlock, since a
+ * reader interrupting the writer on the same CPU would spin forever.
+ * @output The RFLAGS to pass to write_sequnlock.
+ */
+static inline uint64_t
+write_seqlock(seq_lock_t *seq_lock)
+{
+	uint64_t rflags = spin_lock_irqsave(&seq_lock->lock);
+	__atomic_store_n(&seq_lock->sequence, seq_lock->sequence + 1,
+					 __ATOMIC_RELAXED);
+	// Readers must see the odd sequence before any of the writer's stores.
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return rflags;
+}
+
+static inline void
+write_sequnlock(seq_lock_t *seq_lock, uint64_t rflags)
+{
+	__atomic_store_n(&seq_lock->sequence, seq_lock->sequence + 1,
+					 __ATOMIC_RELEASE);
+	spin_unlock_irqrestore(&seq_lock->lock, rflags);
+}
+
+#endif
@@ -1,15 +1,221 @@
 #include "utils/spin_lock.h"
+#include "hal/cpu.h"
+#include "proc/preempt.h"
 
-void 
-wait(spin_lock_t *spin_lock)
+#ifdef SPIN_LOCK_DEBUG
+// Set when a lock is misused, so the culprit can be inspected from gdb once
+// the CPU has halted.
+const void *volatile LOCK_BUG_ADDR;
+const char *volatile LOCK_BUG_REASON;
+
+static inline uint32_t
+lock_cpu_tag()
+{
+	// CPUID's initial APIC ID works before the LAPIC is mapped, which matters
+	// because PrintK takes a lock from the first line of boot.
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	return (ebx >> 24) + 1;
+}
+
+static void
+lock_bug(const void *lock, const char *reason)
 {
-	while(*spin_lock);
-	*spin_lock = true;
+	LOCK_BUG_ADDR	= lock;
+	LOCK_BUG_REASON	= reason;
+	__asm__ volatile("cli");
+	for(;;) {
+		__asm__ volatile("hlt");
+	}
 }
 
-void 
-release(spin_lock_t *spin_lock)
+#define LOCK_DEBUG_ACQUIRE(lock, pc)										\
+	do {																	\
+		if((lock)->owner_cpu == lock_cpu_tag())								\
+			lock_bug((lock), "recursive acquire");							\
+	} while(0)
+
+#define LOCK_DEBUG_SET_OWNER(lock, pc)										\
+	do {																	\
+		(lock)->owner_cpu	= lock_cpu_tag();								\
+		(lock)->owner_pc	= (pc);											\
+	} while(0)
+
+#define LOCK_DEBUG_RELEASE(lock)											\
+	do {																	\
+		if((lock)->owner_cpu != lock_cpu_tag())								\
+			lock_bug((lock), "release by non-owner");						\
+		(lock)->owner_cpu	= 0;											\
+		(lock)->owner_pc	= 0;											\
+	} while(0)
+#else
+#define LOCK_DEBUG_ACQUIRE(lock, pc)
+#define LOCK_DEBUG_SET_OWNER(lock, pc)
+#define LOCK_DEBUG_RELEASE(lock)
+#endif
+
+static inline void
+ticket_acquire(spin_lock_t *lock, uintptr_t pc)
+{
+	LOCK_DEBUG_ACQUIRE(lock, pc);
+
+	uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+	while(__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+		cpu_relax();
+	}
+
+	LOCK_DEBUG_SET_OWNER(lock, pc);
+}
+
+static inline void
+ticket_release(spin_lock_t *lock)
+{
+	LOCK_DEBUG_RELEASE(lock);
+
+	// Only the holder writes "owner", so a plain increment is race-free; the
+	// release store publishes the critical section to the next ticket holder.
+	__atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+static inline void
+mcs_acquire(mcs_lock_t *lock, mcs_node_t *node, uintptr_t pc)
+{
+	LOCK_DEBUG_ACQUIRE(lock, pc);
+
+	node->next		= NULL;
+	node->locked	= true;
+
+	mcs_node_t *prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+	if(prev) {
+		__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+		while(__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+			cpu_relax();
+		}
+	}
+
+	LOCK_DEBUG_SET_OWNER(lock, pc);
+}
+
+static inline void
+mcs_release(mcs_lock_t *lock, mcs_node_t *node)
+{
+	LOCK_DEBUG_RELEASE(lock);
+
+	mcs_node_t *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+	if(!next) {
+		// No known successor. If we are still the tail, the lock is free.
+		mcs_node_t *expected = node;
+		if(__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false,
+									   __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			return;
+		}
+
+		// A successor swapped itself in but has not linked to us yet.
+		while(!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))) {
+			cpu_relax();
+		}
+	}
+
+	__atomic_store_n(&next->locked, false, __ATOMIC_RELEASE);
+}
+
+// Every lock raises the preempt count while held (see proc/preempt.h), so
+// that its holder is not switched out, leaving others to spin until it runs
+// again.
+
+void
+spin_lock(spin_lock_t *lock)
 {
-	*spin_lock = false;
+	uintptr_t pc = (uintptr_t) __builtin_return_address(0);
+	preempt_disable_at(pc);
+	ticket_acquire(lock, pc);
 }
 
+bool
+spin_trylock(spin_lock_t *lock)
+{
+	uintptr_t pc = (uintptr_t) __builtin_return_address(0);
+	uint32_t tickets = __atomic_load_n(&lock->tickets, __ATOMIC_RELAXED);
+	uint16_t owner = tickets & 0xFFFF, next = tickets >> 16;
+	if(owner != next) {
+		return false;
+	}
+
+	// Take the next ticket only if nobody else took it in the meantime.
+	preempt_disable_at(pc);
+	uint32_t taken = tickets + (1 << 16);
+	if(!__atomic_compare_exchange_n(&lock->tickets, &tickets, taken, false,
+									__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		preempt_enable_at(pc);
+		return false;
+	}
+
+	LOCK_DEBUG_SET_OWNER(lock, pc);
+	return true;
+}
+
+void
+spin_unlock(spin_lock_t *lock)
+{
+	ticket_release(lock);
+	preempt_enable_at((uintptr_t) __builtin_return_address(0));
+}
+
+bool
+spin_is_locked(spin_lock_t *lock)
+{
+	uint32_t tickets = __atomic_load_n(&lock->tickets, __ATOMIC_RELAXED);
+	return (tickets & 0xFFFF) != (tickets >> 16);
+}
+
+uint64_t
+spin_lock_irqsave(spin_lock_t *lock)
+{
+	uintptr_t pc = (uintptr_t) __builtin_return_address(0);
+	uint64_t rflags = irq_save();
+	preempt_disable_at(pc);
+	ticket_acquire(lock, pc);
+	return rflags;
+}
+
+void
+spin_unlock_irqrestore(spin_lock_t *lock, uint64_t rflags)
+{
+	ticket_release(lock);
+	irq_restore(rflags);
+	// Only now may a pending reschedule happen.
+	preempt_enable_at((uintptr_t) __builtin_return_address(0));
+}
+
+void
+mcs_lock(mcs_lock_t *lock, mcs_node_t *node)
+{
+	uintptr_t pc = (uintptr_t) __builtin_return_address(0);
+	preempt_disable_at(pc);
+	mcs_acquire(lock, node, pc);
+}
+
+void
+mcs_unlock(mcs_lock_t *lock, mcs_node_t *node)
+{
+	mcs_release(lock, node);
+	preempt_enable_at((uintptr_t) __builtin_return_address(0));
+}
+
+uint64_t
+mcs_lock_irqsave(mcs_lock_t *lock, mcs_node_t *node)
+{
+	uintptr_t pc = (uintptr_t) __builtin_return_address(0);
+	uint64_t rflags = irq_save();
+	preempt_disable_at(pc);
+	mcs_acquire(lock, node, pc);
+	return rflags;
+}
+
+void
+mcs_unlock_irqrestore(mcs_lock_t *lock, mcs_node_t *node, uint64_t rflags)
+{
+	mcs_release(lock, node);
+	irq_restore(rflags);
+	preempt_enable_at((uintptr_t) __builtin_return_address(0));
+}
@@ -2,13 +2,82 @@
 #define SPIN_LOCK_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-typedef bool spin_lock_t;
+/** Ticket lock.
+ * A CPU takes a ticket by atomically incrementing "next", then spins until
+ * "owner" reaches its ticket, so waiters acquire the lock in FIFO order. A
+ * zeroed spin_lock_t is unlocked.
+**/
+typedef struct {
+	union {
+		struct {
+			volatile uint16_t owner;
+			volatile uint16_t next;
+		};
+		volatile uint32_t tickets;
+	};
+#ifdef SPIN_LOCK_DEBUG
+	// LAPIC ID + 1 of the holder (0 when unlocked), and the address from
+	// which it took the lock.
+	volatile uint32_t owner_cpu;
+	volatile uintptr_t owner_pc;
+#endif
+} spin_lock_t;
+
+/** MCS queued lock.
+ * Each waiter enqueues a node (usually on its own stack) and spins on a flag
+ * inside it, so a contended handoff only touches the next waiter's cache
+ * line. The node must stay live until the matching unlock. A zeroed
+ * mcs_lock_t is unlocked.
+**/
+typedef struct mcs_node {
+	struct mcs_node *volatile next;
+	volatile bool locked;
+} mcs_node_t;
+
+typedef struct {
+	mcs_node_t *volatile tail;
+#ifdef SPIN_LOCK_DEBUG
+	volatile uint32_t owner_cpu;
+	volatile uintptr_t owner_pc;
+#endif
+} mcs_lock_t;
+
+void
+spin_lock(spin_lock_t *lock);
+
+bool
+spin_trylock(spin_lock_t *lock);
+
+void
+spin_unlock(spin_lock_t *lock);
+
+bool
+spin_is_locked(spin_lock_t *lock);
+
+/**
+ * Disable interrupts on this CPU, then take the lock. Use for locks which are
+ * also taken from interrupt handlers.
+ * @output The RFLAGS to pass to spin_unlock_irqrestore.
+ */
+uint64_t
+spin_lock_irqsave(spin_lock_t *lock);
+
+void
+spin_unlock_irqrestore(spin_lock_t *lock, uint64_t rflags);
+
+void
+mcs_lock(mcs_lock_t *lock, mcs_node_t *node);
+
+void
+mcs_unlock(mcs_lock_t *lock, mcs_node_t *node);
 
-void 
-wait(spin_lock_t *spin_lock);
+uint64_t
+mcs_lock_irqsave(mcs_lock_t *lock, mcs_node_t *node);
 
-void 
-release(spin_lock_t *spin_lock);
+void
+mcs_unlock_irqrestore(mcs_lock_t *lock, mcs_node_t *node, uint64_t rflags);
 
 #endif
@@ -56,6 +56,17 @@ char *strcpy(char *destination, const char *source) {
     return ptr;
 }
 
+char *strncpy(char *destination, const char *source, size_t n) {
+    size_t i = 0;
+    for (; i < n && source[i] != '\0'; ++i) {
+        destination[i] = source[i];
+    }
+    for (; i < n; ++i) {
+        destination[i] = '\0';
+    }
+    return destination;
+}
+
 int strcmp(const char *X, const char *Y) {
     while (*X) {
         // if characters differ, or end of the second string is reached
@@ -13,6 +13,10 @@ int strcmp(const char *X, const char *Y);
 
 char *strcpy(char *dest, const char *src);
 
+// Copies at most n bytes, padding with '\0'; like strncpy(3), dest is not
+// terminated if src has n or more characters.
+char *strncpy(char *dest, const char *src, size_t n);
+
 unsigned int strlen(const char *s);
 
 
@@ -0,0 +1,15 @@
+#include "vfs/initrd.h"
+
+static void *INITRD;
+
+void
+initrd_mount(void *ustar)
+{
+	__atomic_store_n(&INITRD, ustar, __ATOMIC_RELEASE);
+}
+
+void *
+initrd()
+{
+	return __atomic_load_n(&INITRD, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,21 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+/** The initrd: a ustar archive loaded as a boot module, which is the root of
+ * the file system, e.g. for spawn (see proc/spawn.h).
+**/
+
+/**
+ * Make an archive the initrd.
+ * @input ustar The archive, which must stay in place from then on.
+ */
+void
+initrd_mount(void *ustar);
+
+/**
+ * @output The initrd, NULL if none was mounted.
+ */
+void *
+initrd();
+
+#endif
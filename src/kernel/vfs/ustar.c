@@ -16,6 +16,23 @@ oct2bin(char *str, int size)
 	return n;
 }
 
+static inline bool
+is_dir_child(const char *name, const char *dirname, size_t dir_len)
+{
+	if(strncmp(name, dirname, dir_len) || !name[dir_len]) {
+		return false;
+	}
+
+	// Immediate children have no further '/', save a trailing one for
+	// subdirectories.
+	for(const char *c = name + dir_len; *c; ++c) {
+		if(*c == '/' && *(c + 1)) {
+			return false;
+		}
+	}
+	return true;
+}
+
 void *
 ustar_from_module(struct stivale2_struct_tag_modules *mods, const char *const ustar_name)
 {
@@ -29,63 +46,95 @@ ustar_from_module(struct stivale2_struct_tag_modules *mods, const char *const us
 
 
 char*
-ustar_read(void *ustar, const char *const filename)
+ustar_find(void *ustar, const char *const filename, size_t *len)
 {
 	ustar_entry_t *ustar_ptr = (ustar_entry_t*) ustar;
 	while(! strncmp(ustar_ptr->signature, "ustar", 5)) {
-		size_t len = oct2bin(ustar_ptr->size, 11);
+		*len = oct2bin(ustar_ptr->size, 11);
 		if(! strncmp(ustar_ptr->name, filename, strlen(ustar_ptr->name) + 1)) {
-			char *res = kalloc(len) + 1;
-			memmove(res, (void*) (ustar_ptr + 1), len);
-			return res;
+			return (char*) (ustar_ptr + 1);
 		}
 
 		// Calculate the number of 512-byte blocks taken up by the file by
-		// rounding file size up to nearest multiple of 512.
-		size_t num_blocks = len % BLOCK_SIZE == 0 ? 
-			(len / BLOCK_SIZE) : (len / BLOCK_SIZE) + 1;
-		ustar_ptr += (num_blocks > 0 ? num_blocks : 1);
+		// rounding file size up to nearest multiple of 512, and skip those
+		// and the header.
+		size_t num_blocks = *len % BLOCK_SIZE == 0 ? 
+			(*len / BLOCK_SIZE) : (*len / BLOCK_SIZE) + 1;
+		ustar_ptr += num_blocks + 1;
 	}
 	return NULL;
 }
 
+char*
+ustar_read(void *ustar, const char *const filename)
+{
+	size_t len;
+	char *data = ustar_find(ustar, filename, &len);
+	if(!data) {
+		return NULL;
+	}
+	char *res = kalloc(len) + 1;
+	memmove(res, data, len);
+	return res;
+}
+
 
 ustar_entry_t**
-ustar_readdir(void *ustar, const char *const dirname)
+ustar_readdir(void *ustar, const char *const dirname, arena_t *arena)
 {
 	bool found_dir = false;
-	ustar_entry_t *ustar_ptr = (ustar_entry_t*) ustar;
-	ustar_entry_t **results = kalloc(sizeof(ustar_entry_t*));
-	size_t num_results = 0, arr_size = 1;
-
-	while(!strncmp(ustar_ptr->signature, "ustar", 5)) {
-		size_t len = oct2bin(ustar_ptr->size, 11);
-
-		if(!strncmp(ustar_ptr->name, dirname, strlen(dirname) + 1)) {
-			if(ustar_ptr->filetype == USTAR_DIR) {
-				found_dir = true;
-			} else {
-				if(num_results++ > arr_size) {
-					arr_size *= 2;
-					results = krealloc(results, arr_size * sizeof(ustar_entry_t*));
-				}
+	size_t dir_len = strlen(dirname), num_results = 0;
+	ustar_entry_t *ustar_ptr;
 
-				results[num_results] = (ustar_entry_t*) kalloc(sizeof(ustar_entry_t));
-				memmove(results[num_results], ustar_ptr, sizeof(ustar_entry_t));
+	// Count the directory's entries first, so the result array can be sized
+	// exactly; everything returned comes from the caller's arena and dies
+	// with it.
+	for(int pass = 0; pass < 2; ++pass) {
+		ustar_entry_t **results = NULL;
+		if(pass == 1) {
+			if(!found_dir) {
+				return NULL;
 			}
+			results = arena_alloc(arena, (num_results + 1) * 
+											sizeof(ustar_entry_t*));
+			if(!results) {
+				return NULL;
+			}
+			num_results = 0;
 		}
 
-		// Calculate the number of 512-byte blocks taken up by the file by
-		// rounding file size up to nearest multiple of 512.
-		size_t num_blocks = len % BLOCK_SIZE == 0 ? 
-			(len / BLOCK_SIZE) : (len / BLOCK_SIZE) + 1;
-		ustar_ptr += (num_blocks > 0 ? num_blocks : 1);
-	}
+		ustar_ptr = (ustar_entry_t*) ustar;
+		while(!strncmp(ustar_ptr->signature, "ustar", 5)) {
+			size_t len = oct2bin(ustar_ptr->size, 11);
 
-	if(found_dir) {
-		return results;
+			if(!strncmp(ustar_ptr->name, dirname, dir_len + 1)) {
+				if(ustar_ptr->filetype == USTAR_DIR) {
+					found_dir = true;
+				}
+			} else if(is_dir_child(ustar_ptr->name, dirname, dir_len)) {
+				if(results) {
+					results[num_results] = arena_alloc(arena, sizeof(ustar_entry_t));
+					if(!results[num_results]) {
+						return NULL;
+					}
+					memmove(results[num_results], ustar_ptr, sizeof(ustar_entry_t));
+				}
+				++num_results;
+			}
+
+			// Calculate the number of 512-byte blocks taken up by the file by
+			// rounding file size up to nearest multiple of 512, and skip those
+			// and the header.
+			size_t num_blocks = len % BLOCK_SIZE == 0 ? 
+				(len / BLOCK_SIZE) : (len / BLOCK_SIZE) + 1;
+			ustar_ptr += num_blocks + 1;
+		}
+
+		if(results) {
+			// Arena memory is zeroed, so the array is already NULL-terminated.
+			return results;
+		}
 	}
 
 	return NULL;
 }
-
@@ -6,6 +6,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "stivale2.h"
+#include "memory_management/arena.h"
 
 typedef union {
 	struct {
@@ -42,10 +43,28 @@ typedef enum {
 void *
 ustar_from_module(struct stivale2_struct_tag_modules *mods, const char *const ustar_name);
 
+/**
+ * Find a file in a ustar archive, without copying it.
+ * @input ustar The archive.
+ * @input filename The file's name.
+ * @output len The file's size.
+ * @output The file's data, in the archive, NULL if it does not exist.
+ */
+char *
+ustar_find(void *ustar, const char *const filename, size_t *len);
+
 char *
 ustar_read(void *ustar, const char *const filename);
 
+/**
+ * List the immediate children of a directory in a ustar archive.
+ * @input ustar The archive.
+ * @input dirname The directory's name, including its trailing '/'.
+ * @input arena The arena from which the result is allocated.
+ * @output A NULL-terminated array of copies of the children's headers, NULL if
+ * 		   the directory does not exist.
+ */
 ustar_entry_t**
-ustar_readdir(void *ustar, const char *const dirname);
+ustar_readdir(void *ustar, const char *const dirname, arena_t *arena);
 
 #endif
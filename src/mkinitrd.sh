@@ -0,0 +1,29 @@
+#!/bin/sh
+# Usage: mkinitrd.sh <archive> <files...>
+#
+# Like "tar --create", but pads the archive so that every file's data starts on
+# a 4 KiB boundary. The kernel can then map executables' read-only segments
+# straight from the initrd rather than copying them (see kernel/proc/elf.c).
+set -e
+
+out=$1
+shift
+pad_dir=$(mktemp -d)
+trap 'rm -rf "$pad_dir"' EXIT
+rm -f "$out"
+
+# 512-byte blocks written so far.
+blocks=0
+for file in "$@"; do
+	# A header takes one block, so the data is page-aligned if the header is
+	# the last block of a page. Otherwise, fill the gap with a padding file: one
+	# with n blocks of data takes n + 1.
+	gap=$(( (7 - blocks % 8) % 8 ))
+	if [ "$gap" -gt 0 ]; then
+		truncate -s $(( (gap - 1) * 512 )) "$pad_dir/.pad"
+		tar --append --file "$out" -C "$pad_dir" ./.pad
+		blocks=$(( blocks + gap ))
+	fi
+	tar --append --file "$out" "$file"
+	blocks=$(( blocks + 1 + ($(stat -c %s "$file") + 511) / 512 ))
+done
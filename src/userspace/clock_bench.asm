@@ -0,0 +1,113 @@
+; Clock read benchmark ("make bench-clock"). Reads CLOCK_MONOTONIC ITERATIONS
+; times through the clock_gettime syscall and then through the vDSO (see
+; kernel/proc/vdso.h), and prints the average TSC cycles per read of each,
+; then the CPU the vDSO's getcpu reports.
+ITERATIONS			equ	100000
+CLOCK_MONOTONIC		equ	1
+VDSO_CLOCK_GETTIME	equ	0xBEAFF000
+VDSO_GETCPU			equ	0xBEAFF010
+
+section .data
+	syscall_prefix	db	"syscall: ",0
+	vdso_prefix		db	"vDSO: ",0
+	suffix			db	" cycles per clock_gettime",10,0
+	cpu_prefix		db	"getcpu: CPU ",0
+	newline			db	10,0
+	digits			times 21 db 0
+	timespec		times 2 dq 0
+	cpu				dd	0
+
+section .text
+	global _start
+
+_start:
+	call rdtsc64
+	mov r12, rax
+	mov r13, ITERATIONS
+.syscall:
+	mov rax, 0xe4
+	mov rdi, CLOCK_MONOTONIC
+	mov rsi, timespec
+	syscall
+	dec r13
+	jnz .syscall
+	call rdtsc64
+	sub rax, r12
+	mov rsi, syscall_prefix
+	call print_result
+
+	call rdtsc64
+	mov r12, rax
+	mov r13, ITERATIONS
+.vdso:
+	mov rdi, CLOCK_MONOTONIC
+	mov rsi, timespec
+	mov rax, VDSO_CLOCK_GETTIME
+	call rax
+	dec r13
+	jnz .vdso
+	call rdtsc64
+	sub rax, r12
+	mov rsi, vdso_prefix
+	call print_result
+
+	mov rdi, cpu
+	xor rsi, rsi
+	mov rax, VDSO_GETCPU
+	call rax
+	mov rsi, cpu_prefix
+	call print
+	mov eax, [cpu]
+	call print_decimal
+	mov rsi, newline
+	call print
+
+	xor rdi, rdi
+	mov rax, 0x3c
+	syscall
+
+; The TSC in rax.
+rdtsc64:
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	ret
+
+; Print the string at rsi, then the total cycles in rax averaged over
+; ITERATIONS.
+print_result:
+	push rax
+	call print
+	pop rax
+	xor rdx, rdx
+	mov rcx, ITERATIONS
+	div rcx
+	call print_decimal
+	mov rsi, suffix
+	call print
+	ret
+
+; Print rax in decimal.
+print_decimal:
+	; Convert rax to decimal, from the last digit backwards.
+	lea rdi, [digits + 20]
+	mov rcx, 10
+.digit:
+	xor rdx, rdx
+	div rcx
+	add dl, '0'
+	dec rdi
+	mov [rdi], dl
+	test rax, rax
+	jnz .digit
+
+	mov rsi, rdi
+	call print
+	ret
+
+; Print the null-terminated string at rsi.
+print:
+	mov rax, 1
+	mov rdi, 1
+	int 80h
+	ret
@@ -0,0 +1,67 @@
+; Context-switch latency benchmark. Two copies run on one CPU ("make
+; bench-ctxsw"), each yielding ITERATIONS times, so that every yield switches
+; to the other copy. Each copy prints the average TSC cycles per switch,
+; syscall entry and exit included.
+ITERATIONS	equ	100000
+
+section .data
+	prefix		db	"ctxsw: ",0
+	suffix		db	" cycles per switch",10,0
+	digits		times 21 db 0
+
+section .text
+	global _start
+
+_start:
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	mov r12, rax
+	mov r13, ITERATIONS
+
+.yield:
+	mov rax, 0x18
+	int 80h
+	dec r13
+	jnz .yield
+
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	sub rax, r12
+	; Each of our yields is followed by one of the other copy's, so the time
+	; elapsed covers two switches per iteration.
+	xor rdx, rdx
+	mov rcx, ITERATIONS * 2
+	div rcx
+
+	; Convert rax to decimal, from the last digit backwards.
+	lea rdi, [digits + 20]
+	mov rcx, 10
+.digit:
+	xor rdx, rdx
+	div rcx
+	add dl, '0'
+	dec rdi
+	mov [rdi], dl
+	test rax, rax
+	jnz .digit
+	mov r14, rdi
+
+	mov rsi, prefix
+	call print
+	mov rsi, r14
+	call print
+	mov rsi, suffix
+	call print
+
+	xor rdi, rdi
+	mov rax, 0x3c
+	int 80h
+
+; Print the null-terminated string at rsi.
+print:
+	mov rax, 1
+	mov rdi, 1
+	int 80h
+	ret
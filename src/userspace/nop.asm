@@ -0,0 +1,8 @@
+; Exits straight away: the child userspace/spawn_bench launches.
+section .text
+	global _start
+
+_start:
+	xor rdi, rdi
+	mov rax, 0x3c
+	int 80h
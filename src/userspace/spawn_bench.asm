@@ -0,0 +1,75 @@
+; Process creation latency benchmark ("make bench-spawn"). Spawns ITERATIONS
+; copies of userspace/nop back to back, and prints the average TSC cycles per
+; spawn syscall, i.e. from the call until the child is ready to run.
+ITERATIONS	equ	100
+
+section .data
+	child		db	"./userspace/nop.elf",0
+	prefix		db	"spawn: ",0
+	suffix		db	" cycles per spawn",10,0
+	failed		db	"spawn: failed",10,0
+	digits		times 21 db 0
+
+section .text
+	global _start
+
+_start:
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	mov r12, rax
+	mov r13, ITERATIONS
+
+.spawn:
+	mov rax, 0x3b
+	mov rdi, child
+	int 80h
+	test rax, rax
+	js .failed
+	dec r13
+	jnz .spawn
+
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	sub rax, r12
+	xor rdx, rdx
+	mov rcx, ITERATIONS
+	div rcx
+
+	; Convert rax to decimal, from the last digit backwards.
+	lea rdi, [digits + 20]
+	mov rcx, 10
+.digit:
+	xor rdx, rdx
+	div rcx
+	add dl, '0'
+	dec rdi
+	mov [rdi], dl
+	test rax, rax
+	jnz .digit
+	mov r14, rdi
+
+	mov rsi, prefix
+	call print
+	mov rsi, r14
+	call print
+	mov rsi, suffix
+	call print
+	jmp .exit
+
+.failed:
+	mov rsi, failed
+	call print
+
+.exit:
+	xor rdi, rdi
+	mov rax, 0x3c
+	int 80h
+
+; Print the null-terminated string at rsi.
+print:
+	mov rax, 1
+	mov rdi, 1
+	int 80h
+	ret
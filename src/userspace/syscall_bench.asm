@@ -0,0 +1,86 @@
+; Null syscall benchmark ("make bench-syscall"). Calls getpid ITERATIONS times
+; through int 0x80 and then through syscall, and prints the average TSC
+; cycles per call of each, i.e. the cost of kernel entry and exit.
+ITERATIONS	equ	100000
+
+section .data
+	int80_prefix	db	"int 0x80: ",0
+	syscall_prefix	db	"syscall: ",0
+	suffix			db	" cycles per getpid",10,0
+	digits			times 21 db 0
+
+section .text
+	global _start
+
+_start:
+	call rdtsc64
+	mov r12, rax
+	mov r13, ITERATIONS
+.int80:
+	mov rax, 0x27
+	int 80h
+	dec r13
+	jnz .int80
+	call rdtsc64
+	sub rax, r12
+	mov rsi, int80_prefix
+	call print_result
+
+	call rdtsc64
+	mov r12, rax
+	mov r13, ITERATIONS
+.syscall:
+	mov rax, 0x27
+	syscall
+	dec r13
+	jnz .syscall
+	call rdtsc64
+	sub rax, r12
+	mov rsi, syscall_prefix
+	call print_result
+
+	xor rdi, rdi
+	mov rax, 0x3c
+	syscall
+
+; The TSC in rax.
+rdtsc64:
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	ret
+
+; Print the string at rsi, then the total cycles in rax averaged over
+; ITERATIONS.
+print_result:
+	push rax
+	call print
+	pop rax
+	xor rdx, rdx
+	mov rcx, ITERATIONS
+	div rcx
+
+	; Convert rax to decimal, from the last digit backwards.
+	lea rdi, [digits + 20]
+	mov rcx, 10
+.digit:
+	xor rdx, rdx
+	div rcx
+	add dl, '0'
+	dec rdi
+	mov [rdi], dl
+	test rax, rax
+	jnz .digit
+
+	mov rsi, rdi
+	call print
+	mov rsi, suffix
+	call print
+	ret
+
+; Print the null-terminated string at rsi.
+print:
+	mov rax, 1
+	mov rdi, 1
+	int 80h
+	ret
@@ -0,0 +1,137 @@
+; Batched syscall benchmark ("make bench-uring"). Makes ITERATIONS getpid
+; syscalls, then submits as many NOPs through the submission ring (see
+; kernel/proc/uring.h), ENTRIES per uring_enter, and prints the average TSC
+; cycles per operation of each.
+ITERATIONS	equ	102400
+ENTRIES		equ	256
+
+; uring_header_t offsets, and the size of a uring_sqe_t.
+SQ_OFFSET	equ	8
+SQ_TAIL		equ	64
+CQ_HEAD		equ	68
+CQ_TAIL		equ	132
+SQE_SIZE	equ	40
+SQE_USER	equ	32
+
+section .data
+	syscall_prefix	db	"syscall: ",0
+	syscall_suffix	db	" cycles per getpid",10,0
+	uring_prefix	db	"uring: ",0
+	uring_suffix	db	" cycles per nop",10,0
+	setup_failed	db	"uring_setup failed",10,0
+	digits			times 21 db 0
+
+section .text
+	global _start
+
+_start:
+	call rdtsc64
+	mov r12, rax
+	mov r13, ITERATIONS
+.syscall:
+	mov rax, 0x27
+	syscall
+	dec r13
+	jnz .syscall
+	call rdtsc64
+	sub rax, r12
+	mov rsi, syscall_prefix
+	mov rdi, syscall_suffix
+	call print_result
+
+	; r14 is the ring header, r15 the SQEs.
+	mov rax, 0xa9
+	mov rdi, ENTRIES
+	xor rsi, rsi
+	syscall
+	cmp rax, -1
+	je .failed
+	mov r14, rax
+	mov eax, [r14 + SQ_OFFSET]
+	lea r15, [r14 + rax]
+
+	call rdtsc64
+	mov r12, rax
+	mov r13, ITERATIONS
+.batch:
+	; Fill the SQ with NOPs, each tagged with its index...
+	mov ecx, [r14 + SQ_TAIL]
+	mov rbx, ENTRIES
+.fill:
+	mov eax, ecx
+	and eax, ENTRIES - 1
+	imul rax, rax, SQE_SIZE
+	mov byte [r15 + rax], 0
+	mov [r15 + rax + SQE_USER], rcx
+	inc ecx
+	dec rbx
+	jnz .fill
+	; ...publish them, which needs no fence as x86 does not reorder stores...
+	mov [r14 + SQ_TAIL], ecx
+	; ...submit them all and wait for every completion...
+	mov rax, 0xaa
+	mov rdi, ENTRIES
+	syscall
+	; ...and reap them.
+	mov eax, [r14 + CQ_TAIL]
+	mov [r14 + CQ_HEAD], eax
+	sub r13, ENTRIES
+	jnz .batch
+	call rdtsc64
+	sub rax, r12
+	mov rsi, uring_prefix
+	mov rdi, uring_suffix
+	call print_result
+	jmp .exit
+
+.failed:
+	mov rsi, setup_failed
+	call print
+
+.exit:
+	xor rdi, rdi
+	mov rax, 0x3c
+	syscall
+
+; The TSC in rax.
+rdtsc64:
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	ret
+
+; Print the string at rsi, then the total cycles in rax averaged over
+; ITERATIONS, then the string at rdi.
+print_result:
+	push rdi
+	push rax
+	call print
+	pop rax
+	xor rdx, rdx
+	mov rcx, ITERATIONS
+	div rcx
+
+	; Convert rax to decimal, from the last digit backwards.
+	lea rdi, [digits + 20]
+	mov rcx, 10
+.digit:
+	xor rdx, rdx
+	div rcx
+	add dl, '0'
+	dec rdi
+	mov [rdi], dl
+	test rax, rax
+	jnz .digit
+
+	mov rsi, rdi
+	call print
+	pop rsi
+	call print
+	ret
+
+; Print the null-terminated string at rsi.
+print:
+	mov rax, 1
+	mov rdi, 1
+	int 80h
+	ret